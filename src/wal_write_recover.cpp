@@ -7,6 +7,49 @@
 #include <filesystem>
 #include <stdexcept>
 #include <utility>  
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <memory>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h> // FICLONE
+#endif
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 namespace fs = std::filesystem;
@@ -24,6 +67,19 @@ static inline uint32_t to_be32(uint32_t x) {
     memcpy(&y, b, 4);
     return y;
 }
+static inline uint32_t load_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+static inline uint64_t load_be64(const uint8_t* p) {
+    return ((uint64_t)load_be32(p) << 32) | load_be32(p + 4);
+}
+static inline void store_be32(uint8_t* p, uint32_t x) {
+    p[0] = uint8_t(x >> 24); p[1] = uint8_t(x >> 16); p[2] = uint8_t(x >> 8); p[3] = uint8_t(x);
+}
+static inline void store_be64(uint8_t* p, uint64_t x) {
+    store_be32(p, uint32_t(x >> 32));
+    store_be32(p + 4, uint32_t(x));
+}
 static inline uint32_t from_be32(uint32_t x) {
     uint8_t b[4];
     memcpy(b, &x, 4);
@@ -40,145 +96,4848 @@ static void crc32_init() {
             if (c & 1) c = poly ^ (c >> 1);
             else       c >>= 1;
         }
-        crc32_table[i] = c;
+        crc32_table[i] = c;
+    }
+}
+static inline uint32_t crc32(const uint8_t* data, size_t n) {
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i=0; i<n; ++i) {
+        c = crc32_table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+// ----------- Hashing (64-bit, non-cryptographic) -----------
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+static inline uint64_t load_le64(const uint8_t* p) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+// splitmix64 finalizer
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27; x *= 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+// Four independent lanes of 8-byte words (xxHash64-style) so large blocks
+// hash at memory speed; used for Merkle leaves, not for frame integrity.
+static uint64_t hash64(const uint8_t* p, size_t n, uint64_t seed = 0) {
+    const uint64_t P1 = 0x9E3779B185EBCA87ull, P2 = 0xC2B2AE3D27D4EB4Full;
+    uint64_t a = seed + P1 + P2, b = seed + P2, c = seed, d = seed - P1;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        a = rotl64(a + load_le64(p + i) * P2, 31) * P1;
+        b = rotl64(b + load_le64(p + i + 8) * P2, 31) * P1;
+        c = rotl64(c + load_le64(p + i + 16) * P2, 31) * P1;
+        d = rotl64(d + load_le64(p + i + 24) * P2, 31) * P1;
+    }
+    uint64_t h = rotl64(a, 1) + rotl64(b, 7) + rotl64(c, 12) + rotl64(d, 18) + n;
+    for (; i + 8 <= n; i += 8) h = rotl64(h ^ (load_le64(p + i) * P2), 27) * P1;
+    for (; i < n; ++i) h = rotl64(h ^ (p[i] * P1), 11) * P2;
+    return mix64(h);
+}
+
+// ----------- I/O helpers -----------
+static bool write_all(ofstream& f, const void* buf, size_t n) {
+    f.write(reinterpret_cast<const char*>(buf), n);
+    return bool(f);
+}
+static bool read_exact(ifstream& f, void* buf, size_t n) {
+    f.read(reinterpret_cast<char*>(buf), n);
+    return size_t(f.gcount()) == n;
+}
+// Loops over short writes and EINTR; works for files and sockets.
+static bool write_all_fd(int fd, const void* buf, size_t n) {
+    const char* p = static_cast<const char*>(buf);
+    while (n > 0) {
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return true;
+}
+
+// Serializes whole lines written from concurrent scans.
+static mutex cout_mu;
+
+// ----------- Durability helpers -----------
+static double ms_since(chrono::steady_clock::time_point t0) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+}
+
+// fdatasync where available; it skips the inode flush when only data changed.
+static int data_sync(int fd) {
+#if defined(__linux__)
+    return ::fdatasync(fd);
+#else
+    return ::fsync(fd);
+#endif
+}
+
+// Drops the whole pages of [from, to) of `fd` from the page cache and returns
+// how many bytes were advised. Pages must be clean (written back) to be
+// dropped, so callers only advise ranges behind a sync/writeback point.
+static uint64_t drop_cached(int fd, uint64_t from, uint64_t to) {
+#if defined(__linux__)
+    const uint64_t PAGE = 4096;
+    uint64_t a = (from + PAGE - 1) & ~(PAGE - 1), b = to & ~(PAGE - 1);
+    if (fd < 0 || b <= a) return 0;
+    return ::posix_fadvise(fd, (off_t)a, (off_t)(b - a), POSIX_FADV_DONTNEED) == 0 ? b - a : 0;
+#else
+    (void)fd; (void)from; (void)to;
+    return 0;
+#endif
+}
+
+// fsync a file or directory by path. Directories need O_RDONLY, which also
+// works for regular files, so one code path serves both.
+static bool fsync_path(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+static string parent_dir(const string& path) {
+    fs::path p = fs::path(path).parent_path();
+    return p.empty() ? string(".") : p.string();
+}
+
+// Collects files whose size changed (truncation) so their metadata can be made
+// durable together. The parent directory is synced once per directory: the
+// WAL may have been created right before the crash, and its entry is not
+// durable until the directory itself is synced.
+struct SyncBatch {
+    mutex mu; // add() may be called from concurrent scans
+    set<string> files;
+    set<string> dirs;
+    size_t synced_files = 0;
+    size_t synced_dirs = 0;
+    double sync_ms = 0;
+
+    void add(const string& path) {
+        lock_guard<mutex> lk(mu);
+        files.insert(path);
+        dirs.insert(parent_dir(path));
+    }
+
+    // Syncs everything queued so far. Independent fsyncs are issued from a
+    // pool of up to one thread per core so the device can merge the cache
+    // flushes; with many files on one filesystem a single syncfs() replaces
+    // the per-file calls.
+    bool flush() {
+        if (files.empty() && dirs.empty()) return true;
+        auto t0 = chrono::steady_clock::now();
+        bool ok = true;
+#ifdef __linux__
+        const size_t SYNCFS_THRESHOLD = 16;
+        if (files.size() >= SYNCFS_THRESHOLD && dirs.size() == 1) {
+            int fd = ::open(dirs.begin()->c_str(), O_RDONLY);
+            ok = fd >= 0 && ::syncfs(fd) == 0;
+            if (fd >= 0) ::close(fd);
+            synced_files += files.size();
+            synced_dirs += dirs.size();
+            files.clear();
+            dirs.clear();
+            sync_ms += ms_since(t0);
+            return ok;
+        }
+#endif
+        vector<string> todo(files.begin(), files.end());
+        vector<char> results(todo.size(), 1);
+        atomic<size_t> next{0};
+        auto work = [&] {
+            for (size_t i; (i = next.fetch_add(1)) < todo.size();) results[i] = fsync_path(todo[i]);
+        };
+        vector<thread> workers;
+        size_t pool = min<size_t>(todo.size(), max(1u, thread::hardware_concurrency()));
+        for (size_t t = 1; t < pool; ++t) workers.emplace_back(work);
+        work();
+        for (auto& t : workers) t.join();
+        for (char r : results) ok = ok && r;
+        // directories after files: the entry must not become durable before the data
+        for (const auto& d : dirs) ok = fsync_path(d) && ok;
+        synced_files += files.size();
+        synced_dirs += dirs.size();
+        files.clear();
+        dirs.clear();
+        sync_ms += ms_since(t0);
+        return ok;
+    }
+};
+
+// ----------- Env (file-system abstraction) -----------
+// The writer, the scanner, truncation and tail corruption reach the log
+// through an Env, so they run against memory as well as disk. PosixEnv is
+// the real thing. MemEnv keeps files in memory and models what a crash
+// keeps: each file holds its durable contents plus the writes made since its
+// last sync, and a newly created file only survives once its directory was
+// synced. The checkpoint and logical-start sidecars go through the Env too
+// (replaced atomically and durably); the Merkle sidecar, time index,
+// snapshots and page-cache hints remain POSIX-only.
+enum class OpenMode { Read, Append, Update }; // Append creates a missing file
+
+struct EnvFile {
+    virtual ~EnvFile() {}
+    virtual bool read_at(uint64_t off, void* p, size_t n) = 0; // exactly n bytes
+    virtual bool append(const void* p, size_t n) = 0;
+    virtual bool write_at(uint64_t off, const void* p, size_t n) = 0;
+    virtual bool sync() = 0;                 // contents and size durable
+    virtual uint64_t size() = 0;
+    virtual int fd() const { return -1; }    // POSIX descriptor, for hints and hole punching
+};
+
+struct Env {
+    virtual ~Env() {}
+    virtual unique_ptr<EnvFile> open(const string& path, OpenMode mode) = 0;
+    virtual bool file_size(const string& path, uint64_t& n) = 0;
+    virtual bool truncate(const string& path, uint64_t n) = 0;
+    virtual bool sync_file(const string& path) = 0;
+    virtual bool sync_dir(const string& dir) = 0;
+    virtual bool remove(const string& path) = 0;
+    virtual bool read_file(const string& path, vector<uint8_t>& out) = 0;
+    // Durably replaces `path` (tmp + sync + rename + directory sync).
+    virtual bool replace_file(const string& path, const void* p, size_t n) = 0;
+    virtual bool is_posix() const { return false; }
+};
+
+struct PosixFile : EnvFile {
+    int f = -1;
+    explicit PosixFile(int fd_) : f(fd_) {}
+    ~PosixFile() override { if (f >= 0) ::close(f); }
+    bool read_at(uint64_t off, void* p, size_t n) override {
+        char* q = static_cast<char*>(p);
+        while (n > 0) {
+            ssize_t r = ::pread(f, q, n, (off_t)off);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            q += r;
+            off += (uint64_t)r;
+            n -= (size_t)r;
+        }
+        return true;
+    }
+    bool append(const void* p, size_t n) override { return write_all_fd(f, p, n); }
+    bool write_at(uint64_t off, const void* p, size_t n) override {
+        const char* q = static_cast<const char*>(p);
+        while (n > 0) {
+            ssize_t w = ::pwrite(f, q, n, (off_t)off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return false;
+            q += w;
+            off += (uint64_t)w;
+            n -= (size_t)w;
+        }
+        return true;
+    }
+    bool sync() override { return data_sync(f) == 0; }
+    uint64_t size() override {
+        struct stat st;
+        return ::fstat(f, &st) == 0 ? (uint64_t)st.st_size : 0;
+    }
+    int fd() const override { return f; }
+};
+
+struct PosixEnv : Env {
+    unique_ptr<EnvFile> open(const string& path, OpenMode mode) override {
+        int flags = mode == OpenMode::Read ? O_RDONLY : mode == OpenMode::Append ? O_RDWR | O_CREAT | O_APPEND : O_RDWR;
+        int fd = ::open(path.c_str(), flags, 0644);
+        if (fd < 0) return nullptr;
+        return unique_ptr<EnvFile>(new PosixFile(fd));
+    }
+    bool file_size(const string& path, uint64_t& n) override {
+        error_code ec;
+        n = fs::file_size(path, ec);
+        if (ec) n = 0;
+        return !ec;
+    }
+    bool truncate(const string& path, uint64_t n) override {
+        try {
+            fs::resize_file(path, n);
+            return true;
+        } catch (const fs::filesystem_error& e) {
+            cerr << "[recover] truncate error: " << e.what() << "\n";
+            return false;
+        }
+    }
+    bool sync_file(const string& path) override { return fsync_path(path); }
+    bool sync_dir(const string& dir) override { return fsync_path(dir); }
+    bool remove(const string& path) override { return ::unlink(path.c_str()) == 0 || errno == ENOENT; }
+    bool read_file(const string& path, vector<uint8_t>& out) override {
+        ifstream f(path, ios::binary);
+        if (!f) return false;
+        out.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+        return true;
+    }
+    bool replace_file(const string& path, const void* p, size_t n) override {
+        string tmp = path + ".tmp";
+        {
+            ofstream f(tmp, ios::binary | ios::trunc);
+            if (!f || !write_all(f, p, n)) return false;
+            f.close();
+            if (!f) return false;
+        }
+        if (!fsync_path(tmp) || ::rename(tmp.c_str(), path.c_str()) != 0) return false;
+        return fsync_path(parent_dir(path));
+    }
+    bool is_posix() const override { return true; }
+};
+
+static Env& posix_env() {
+    static PosixEnv env;
+    return env;
+}
+
+struct MemEnv : Env {
+    // One change not yet synced: bytes written at `off`, or a truncation to
+    // `off` (`truncate` set, no bytes).
+    struct Write {
+        uint64_t off = 0;
+        vector<uint8_t> bytes;
+        bool truncate = false;
+    };
+    struct Node {
+        vector<uint8_t> data;    // what reads see
+        vector<uint8_t> durable; // contents as of the last sync
+        vector<Write> pending;   // changes since, in order
+        bool linked = false;     // directory entry durable
+    };
+    // Decides, after a crash, how many leading bytes of pending write `i`
+    // of `path` reached the disk (0 = none; any value for a truncation
+    // applies it).
+    using KeepFn = function<size_t(const string& path, size_t i, const Write& w)>;
+
+    mutex mu;
+    unordered_map<string, shared_ptr<Node>> files;
+    uint64_t syncs = 0, bytes_written = 0;
+
+    static void apply(vector<uint8_t>& v, const Write& w, size_t n) {
+        if (w.truncate) {
+            v.resize(w.off);
+            return;
+        }
+        if (n == 0) return;
+        if (v.size() < w.off + n) v.resize(w.off + n);
+        memcpy(v.data() + w.off, w.bytes.data(), n);
+    }
+    static void record(Node& nd, uint64_t off, const void* p, size_t n) {
+        Write w;
+        w.off = off;
+        w.bytes.assign(static_cast<const uint8_t*>(p), static_cast<const uint8_t*>(p) + n);
+        apply(nd.data, w, n);
+        nd.pending.push_back(std::move(w));
+    }
+    static void flush(Node& nd) {
+        for (const auto& w : nd.pending) apply(nd.durable, w, w.bytes.size());
+        nd.pending.clear();
+    }
+
+    struct File : EnvFile {
+        MemEnv* env;
+        shared_ptr<Node> node;
+        bool writable;
+        File(MemEnv* e, shared_ptr<Node> n, bool w) : env(e), node(std::move(n)), writable(w) {}
+        bool read_at(uint64_t off, void* p, size_t n) override {
+            lock_guard<mutex> lk(env->mu);
+            if (off + n > node->data.size()) return false;
+            memcpy(p, node->data.data() + off, n);
+            return true;
+        }
+        bool append(const void* p, size_t n) override { return write(node->data.size(), p, n, true); }
+        bool write_at(uint64_t off, const void* p, size_t n) override { return write(off, p, n, false); }
+        bool write(uint64_t off, const void* p, size_t n, bool at_end) {
+            if (!writable) return false;
+            lock_guard<mutex> lk(env->mu);
+            record(*node, at_end ? node->data.size() : off, p, n);
+            env->bytes_written += n;
+            return true;
+        }
+        bool sync() override {
+            lock_guard<mutex> lk(env->mu);
+            flush(*node);
+            env->syncs++;
+            return true;
+        }
+        uint64_t size() override {
+            lock_guard<mutex> lk(env->mu);
+            return node->data.size();
+        }
+    };
+
+    shared_ptr<Node> find(const string& path) {
+        auto it = files.find(path);
+        return it == files.end() ? nullptr : it->second;
+    }
+
+    unique_ptr<EnvFile> open(const string& path, OpenMode mode) override {
+        lock_guard<mutex> lk(mu);
+        shared_ptr<Node> n = find(path);
+        if (!n) {
+            if (mode != OpenMode::Append) return nullptr;
+            n = files[path] = make_shared<Node>();
+        }
+        return unique_ptr<EnvFile>(new File(this, n, mode != OpenMode::Read));
+    }
+    bool file_size(const string& path, uint64_t& sz) override {
+        lock_guard<mutex> lk(mu);
+        shared_ptr<Node> n = find(path);
+        sz = n ? n->data.size() : 0;
+        return n != nullptr;
+    }
+    bool truncate(const string& path, uint64_t sz) override {
+        lock_guard<mutex> lk(mu);
+        shared_ptr<Node> n = find(path);
+        if (!n) return false;
+        Write w;
+        w.off = sz;
+        w.truncate = true;
+        apply(n->data, w, 0);
+        n->pending.push_back(std::move(w));
+        return true;
+    }
+    bool sync_file(const string& path) override {
+        lock_guard<mutex> lk(mu);
+        shared_ptr<Node> n = find(path);
+        if (n) {
+            flush(*n);
+            syncs++;
+        }
+        return n != nullptr;
+    }
+    bool sync_dir(const string& dir) override {
+        lock_guard<mutex> lk(mu);
+        for (auto& f : files) {
+            if (parent_dir(f.first) == dir) f.second->linked = true;
+        }
+        return true;
+    }
+    bool remove(const string& path) override {
+        lock_guard<mutex> lk(mu);
+        files.erase(path);
+        return true;
+    }
+    bool read_file(const string& path, vector<uint8_t>& out) override {
+        lock_guard<mutex> lk(mu);
+        shared_ptr<Node> n = find(path);
+        if (n) out = n->data;
+        return n != nullptr;
+    }
+    bool replace_file(const string& path, const void* p, size_t sz) override {
+        lock_guard<mutex> lk(mu);
+        auto n = make_shared<Node>();
+        n->data.assign(static_cast<const uint8_t*>(p), static_cast<const uint8_t*>(p) + sz);
+        n->durable = n->data;
+        n->linked = true;
+        files[path] = n;
+        return true;
+    }
+
+    // Simulates a power loss: files whose directory entry was never synced
+    // disappear, and each remaining file keeps its durable contents plus
+    // whatever `keep` says of its pending writes (nothing by default).
+    // Open EnvFiles keep referring to the pre-crash nodes.
+    void crash(const KeepFn& keep = nullptr) {
+        lock_guard<mutex> lk(mu);
+        for (auto it = files.begin(); it != files.end();) {
+            if (!it->second->linked) {
+                it = files.erase(it);
+                continue;
+            }
+            auto n = make_shared<Node>();
+            n->durable = it->second->durable;
+            n->linked = true;
+            const auto& pend = it->second->pending;
+            for (size_t i = 0; keep && i < pend.size(); ++i) {
+                size_t k = keep(it->first, i, pend[i]);
+                if (k > 0) apply(n->durable, pend[i], min(k, pend[i].bytes.size()));
+            }
+            n->data = n->durable;
+            it->second = n;
+            ++it;
+        }
+    }
+};
+
+// ----------- Zero-fill detection -----------
+// Offset of the first non-zero byte in [from, end), or `end`.
+static uint64_t first_nonzero(const uint8_t* p, uint64_t from, uint64_t end) {
+    uint64_t i = from;
+#if defined(__AVX2__)
+    for (; i + 128 <= end; i += 128) {
+        const __m256i* v = reinterpret_cast<const __m256i*>(p + i);
+        __m256i acc = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(v), _mm256_loadu_si256(v + 1)),
+                                      _mm256_or_si256(_mm256_loadu_si256(v + 2), _mm256_loadu_si256(v + 3)));
+        if (!_mm256_testz_si256(acc, acc)) break;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 64 <= end; i += 64) {
+        const __m128i* v = reinterpret_cast<const __m128i*>(p + i);
+        __m128i acc = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(v), _mm_loadu_si128(v + 1)),
+                                   _mm_or_si128(_mm_loadu_si128(v + 2), _mm_loadu_si128(v + 3)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF) break;
+    }
+#endif
+    for (; i < end; ++i) {
+        if (p[i]) return i;
+    }
+    return end;
+}
+
+struct ZeroTail {
+    bool all_zero = false;
+    bool sampled = false;       // only part of the written zeros was read
+    uint64_t padding_bytes = 0; // zero bytes from the start offset to EOF
+    uint64_t hole_bytes = 0;    // of which unallocated (never read)
+};
+
+// Written zeros read by default when classifying a tail: the classification
+// only feeds a report (the cut lands at `from` either way), so it must not
+// cost recovery O(padding).
+static const uint64_t ZERO_PROBE_BYTES = 64 * 1024;
+
+// Checks whether [from, sz) is zero. Sparse holes are skipped with
+// SEEK_DATA/SEEK_HOLE without reading, so a preallocated-but-unwritten tail
+// costs a couple of syscalls. Written zeros are compared only up to
+// `max_read` bytes, plus the last `max_read` before EOF; past that the tail is
+// reported as `sampled` padding. Pass UINT64_MAX for a full check.
+static ZeroTail check_zero_tail(const string& path, uint64_t from, uint64_t sz, Env& env = posix_env(),
+                                uint64_t max_read = ZERO_PROBE_BYTES) {
+    ZeroTail Z;
+    unique_ptr<EnvFile> f = env.open(path, OpenMode::Read);
+    if (!f) return Z;
+    int fd = f->fd(); // holes can only be found on POSIX files
+    vector<uint8_t> buf((size_t)min<uint64_t>(1 << 20, max(max_read, uint64_t(1))));
+    auto zero = [&](uint64_t at, uint64_t end) {
+        while (at < end) {
+            size_t n = (size_t)min<uint64_t>(buf.size(), end - at);
+            if (!f->read_at(at, buf.data(), n) || first_nonzero(buf.data(), 0, n) != n) return false;
+            at += n;
+        }
+        return true;
+    };
+    uint64_t pos = from, read = 0;
+    bool ok = true;
+    while (ok && pos < sz) {
+        uint64_t data_end = sz;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        off_t d = fd >= 0 ? ::lseek(fd, (off_t)pos, SEEK_DATA) : (off_t)pos;
+        if (d < 0) {
+            if (errno == ENXIO) { Z.hole_bytes += sz - pos; pos = sz; break; }
+        } else {
+            Z.hole_bytes += (uint64_t)d - pos;
+            pos = (uint64_t)d;
+            off_t h = fd >= 0 ? ::lseek(fd, (off_t)pos, SEEK_HOLE) : (off_t)sz;
+            if (h > (off_t)pos && (uint64_t)h < sz) data_end = (uint64_t)h;
+        }
+#endif
+        if (read + (data_end - pos) > max_read) {
+            // budget spent: check the end of the file too, and stop there
+            uint64_t n = max_read - read, tail = max(pos + n, sz > max_read ? sz - max_read : 0);
+            ok = zero(pos, pos + n) && zero(tail, sz);
+            Z.sampled = true;
+            pos = sz;
+            break;
+        }
+        ok = zero(pos, data_end);
+        read += data_end - pos;
+        pos = data_end;
+    }
+    Z.all_zero = ok && pos >= sz;
+    Z.padding_bytes = Z.all_zero ? sz - from : 0;
+    if (!Z.all_zero) Z.hole_bytes = 0;
+    return Z;
+}
+
+// ----------- Log format -----------
+// Plain logs are a bare sequence of [len][payload][crc] frames. Logs using
+// optional per-frame fields start with an 8-byte header: "WALX" + u32 flags.
+// 'W' (0x57) can never lead a plausible length, so the layouts cannot be
+// confused. Extension fields sit between len and payload and are covered by
+// the frame CRC:  [u32 len][ext fields][payload][u32 crc(ext + payload)]
+static const uint32_t MAX_REC = 32 * 1024 * 1024; // 32MB sanity
+static const uint32_t LOG_MAGIC = 0x57414C58;     // "WALX"
+static const uint64_t LOG_HEADER_BYTES = 8;
+
+// format flags; ext fields appear in this order
+static const uint32_t FMT_CHAINED = 1u << 0;  // u64 running hash of all prior frames
+static const uint32_t FMT_SEQ = 1u << 1;      // u64 record sequence number (+1 per record)
+static const uint32_t FMT_CIRCULAR = 1u << 2; // fixed-size ring file; requires FMT_SEQ
+static const uint32_t FMT_TIME = 1u << 3;     // u64 timestamp, microseconds since the epoch, never decreasing
+static const uint32_t FMT_KNOWN = FMT_CHAINED | FMT_SEQ | FMT_CIRCULAR | FMT_TIME;
+static const uint32_t MAX_EXT_BYTES = 24;
+
+// Length value marking "rest of the ring is unused, continue at ring start".
+static const uint32_t WRAP_MARKER = 0xFFFFFFFFu;
+
+struct LogFormat {
+    uint32_t flags = 0;
+    bool headered() const { return flags != 0; }
+    uint64_t data_start() const { return headered() ? LOG_HEADER_BYTES : 0; }
+    uint32_t seq_offset() const { return (flags & FMT_CHAINED) ? 8 : 0; } // within ext fields
+    uint32_t time_offset() const { return seq_offset() + ((flags & FMT_SEQ) ? 8 : 0); }
+    uint32_t ext_bytes() const { return time_offset() + ((flags & FMT_TIME) ? 8 : 0); }
+    uint64_t frame_size(uint32_t len) const { return 8ull + ext_bytes() + len; }
+};
+
+enum class HeaderStatus { Ok, Torn, Unsupported };
+
+// Decodes the format from the first bytes of a log (`n` = bytes available).
+static HeaderStatus parse_log_header(const uint8_t* p, uint64_t n, LogFormat& F) {
+    F = LogFormat{};
+    if (n == 0 || p[0] != uint8_t(LOG_MAGIC >> 24)) return HeaderStatus::Ok; // plain
+    if (n < LOG_HEADER_BYTES) return HeaderStatus::Torn;
+    if (load_be32(p) != LOG_MAGIC) return HeaderStatus::Unsupported;
+    uint32_t flags = load_be32(p + 4);
+    if (flags == 0 || (flags & ~FMT_KNOWN)) return HeaderStatus::Unsupported;
+    // a ring overwrites its oldest frames, so a chain from the start cannot exist
+    if ((flags & FMT_CIRCULAR) && (!(flags & FMT_SEQ) || (flags & FMT_CHAINED))) return HeaderStatus::Unsupported;
+    F.flags = flags;
+    return HeaderStatus::Ok;
+}
+
+// Chain value after a frame: commits to the previous chain and to the frame's
+// CRC (which itself covers that frame's stored chain field and payload).
+// Frame i stores the chain over frames [0, i); the empty log's chain is 0.
+static inline uint64_t chain_next(uint64_t chain, uint32_t crc, uint32_t len) {
+    return mix64(chain * 0x9E3779B97F4A7C15ull + ((((uint64_t)crc) << 32) | len));
+}
+
+static inline bool len_plausible(uint32_t len) { return len != 0 && len <= MAX_REC; }
+
+struct FrameInfo {
+    uint32_t crc = 0;
+    uint64_t chain = 0; // stored chain field (FMT_CHAINED)
+    uint64_t seq = 0;   // stored sequence number (FMT_SEQ)
+    uint64_t ts = 0;    // stored timestamp (FMT_TIME)
+};
+
+// Checks a frame's body (everything after the length: ext fields, payload,
+// crc) for payload length `len` and decodes its ext fields into `fi`.
+// Shared by the scanner and the replication follower so both accept exactly
+// the same frames.
+static inline bool check_frame_body(const LogFormat& F, const uint8_t* body, uint32_t len, FrameInfo& fi) {
+    fi.crc = crc32(body, F.ext_bytes() + len);
+    if (load_be32(body + F.ext_bytes() + len) != fi.crc) return false;
+    fi.chain = (F.flags & FMT_CHAINED) ? load_be64(body) : 0;
+    fi.seq = (F.flags & FMT_SEQ) ? load_be64(body + F.seq_offset()) : 0;
+    fi.ts = (F.flags & FMT_TIME) ? load_be64(body + F.time_offset()) : 0;
+    return true;
+}
+
+// Appends one encoded frame to `out`; returns the frame CRC.
+static uint32_t encode_frame(const LogFormat& F, uint64_t chain, uint64_t seq, uint64_t ts, const uint8_t* payload,
+                             uint32_t len, vector<uint8_t>& out) {
+    size_t at = out.size();
+    out.resize(at + F.frame_size(len));
+    uint8_t* p = out.data() + at;
+    store_be32(p, len);
+    uint8_t* ext = p + 4;
+    if (F.flags & FMT_CHAINED) store_be64(ext, chain);
+    if (F.flags & FMT_SEQ) store_be64(ext + F.seq_offset(), seq);
+    if (F.flags & FMT_TIME) store_be64(ext + F.time_offset(), ts);
+    memcpy(ext + F.ext_bytes(), payload, len);
+    uint32_t c = crc32(ext, F.ext_bytes() + len);
+    store_be32(ext + F.ext_bytes() + len, c);
+    return c;
+}
+
+// ----------- Checkpoints -----------
+// `<log>.ckpt` certifies a prefix of a chained log: the chain after the frame
+// at `last_frame` (which ends at `offset`). Recovery re-verifies that single
+// frame, then only scans what follows.
+struct Checkpoint {
+    uint64_t offset = 0;
+    uint64_t chain = 0;
+    uint64_t last_frame = 0;
+    uint64_t records = 0;
+};
+static const size_t CKPT_BYTES = 4 * 8 + 4;
+
+static string checkpoint_path(const string& path) { return path + ".ckpt"; }
+
+// Writes the checkpoint via tmp + fsync + rename + directory fsync.
+static bool store_checkpoint(const string& path, const Checkpoint& C, Env& env = posix_env()) {
+    uint8_t b[CKPT_BYTES];
+    store_be64(b, C.offset);
+    store_be64(b + 8, C.chain);
+    store_be64(b + 16, C.last_frame);
+    store_be64(b + 24, C.records);
+    store_be32(b + 32, crc32(b, 32));
+    return env.replace_file(checkpoint_path(path), b, sizeof b);
+}
+
+static bool load_checkpoint(const string& path, Checkpoint& C, Env& env = posix_env()) {
+    vector<uint8_t> v;
+    if (!env.read_file(checkpoint_path(path), v) || v.size() < CKPT_BYTES) return false;
+    const uint8_t* b = v.data();
+    if (load_be32(b + 32) != crc32(b, 32)) return false;
+    C.offset = load_be64(b);
+    C.chain = load_be64(b + 8);
+    C.last_frame = load_be64(b + 16);
+    C.records = load_be64(b + 24);
+    return true;
+}
+
+// ----------- Rate limiting -----------
+// Classic token bucket in bytes: refills at `rate` bytes/sec up to `burst`;
+// acquire() sleeps until the request can be paid. rate == 0 means unlimited.
+struct TokenBucket {
+    double rate = 0;
+    double burst = 0;
+    double tokens = 0;
+    chrono::steady_clock::time_point last = chrono::steady_clock::now();
+
+    explicit TokenBucket(double bytes_per_sec = 0, double burst_bytes = 0)
+        : rate(bytes_per_sec), burst(burst_bytes > 0 ? burst_bytes : bytes_per_sec / 10), tokens(burst) {}
+
+    // Takes `n` tokens if available; otherwise returns false and sets `wait_s`
+    // to the time until they will be. A request larger than the burst is
+    // allowed to drive tokens negative so it is not starved forever.
+    bool try_take(uint64_t n, double& wait_s) {
+        auto now = chrono::steady_clock::now();
+        tokens = min(burst, tokens + rate * chrono::duration<double>(now - last).count());
+        last = now;
+        double need = min<double>((double)n, burst);
+        if (tokens >= need) { tokens -= (double)n; return true; }
+        wait_s = (need - tokens) / rate;
+        return false;
+    }
+
+    void acquire(uint64_t n) {
+        if (rate <= 0) return;
+        double wait = 0;
+        while (!try_take(n, wait)) this_thread::sleep_for(chrono::duration<double>(wait));
+    }
+};
+
+// Lower value = served first: a waiting request never lets a lower-priority
+// one take tokens ahead of it.
+enum class IoPriority { Tail = 0, Full = 1, Background = 2 };
+static const int IO_PRIORITIES = 3;
+
+// Process-wide, thread-safe byte budget shared by concurrent recovery scans
+// (and the scrubber), so many shards recovering at once cannot saturate the
+// device and tail verification goes ahead of full scans.
+struct IoLimiter {
+    mutex mu;
+    condition_variable cv;
+    TokenBucket bucket;
+    size_t waiting[IO_PRIORITIES] = {};
+    uint64_t granted[IO_PRIORITIES] = {};
+    double waited_ms[IO_PRIORITIES] = {};
+
+    void set_rate(double bytes_per_sec) {
+        lock_guard<mutex> lk(mu);
+        bucket = TokenBucket(bytes_per_sec);
+    }
+
+    void acquire(uint64_t n, IoPriority prio) {
+        int p = (int)prio;
+        unique_lock<mutex> lk(mu);
+        granted[p] += n;
+        if (bucket.rate <= 0) return;
+        auto t0 = chrono::steady_clock::now();
+        waiting[p]++;
+        for (;;) {
+            bool higher_waiting = false;
+            for (int q = 0; q < p; ++q) higher_waiting = higher_waiting || waiting[q] > 0;
+            double wait = 0.001;
+            if (!higher_waiting && bucket.try_take(n, wait)) break;
+            cv.wait_for(lk, chrono::duration<double>(wait));
+        }
+        waiting[p]--;
+        waited_ms[p] += ms_since(t0);
+        cv.notify_all();
+    }
+};
+
+static IoLimiter& recovery_io_limiter() {
+    static IoLimiter limiter;
+    return limiter;
+}
+
+
+// Puts the calling thread in the idle I/O class so its reads only use
+// otherwise idle disk time (CFQ/BFQ honor it). No-op where unsupported.
+static bool set_idle_io_priority() {
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    const int IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_IDLE = 3, IOPRIO_CLASS_SHIFT = 13;
+    return ::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == 0;
+#else
+    return false;
+#endif
+}
+
+// ----------- Logical start (head trimming) -----------
+// `<log>.start` records where the live log begins after trim_head(): the
+// offset of the oldest kept frame and its LSN (sequence number for FMT_SEQ
+// logs, record ordinal otherwise). Bytes before it are released with hole
+// punching, or removed with FALLOC_FL_COLLAPSE_RANGE; `pending_collapse` is
+// set while a collapse is in flight, so a crash between the collapse and the
+// final update can be resolved by checking both candidate offsets.
+struct LogStart {
+    uint64_t offset = 0;
+    uint64_t lsn = 0;
+    uint64_t pending_collapse = 0;
+};
+
+static string log_start_path(const string& path) { return path + ".start"; }
+
+static bool store_log_start(const string& path, const LogStart& S, Env& env = posix_env()) {
+    uint8_t b[28];
+    store_be64(b, S.offset);
+    store_be64(b + 8, S.lsn);
+    store_be64(b + 16, S.pending_collapse);
+    store_be32(b + 24, crc32(b, 24));
+    return env.replace_file(log_start_path(path), b, sizeof b);
+}
+
+static bool load_log_start(const string& path, LogStart& S, Env& env = posix_env()) {
+    vector<uint8_t> v;
+    if (!env.read_file(log_start_path(path), v) || v.size() < 28) return false;
+    const uint8_t* b = v.data();
+    if (load_be32(b + 24) != crc32(b, 24)) return false;
+    S.offset = load_be64(b);
+    S.lsn = load_be64(b + 8);
+    S.pending_collapse = load_be64(b + 16);
+    return true;
+}
+
+// ----------- Recovery Scanner -----------
+// Sequential reads through an EnvFile, served from a window of up to 1MB
+// (never more than the file) so small frames do not cost a call each; larger
+// reads go straight to the file.
+struct ReadAhead {
+    EnvFile& file;
+    uint64_t file_size;
+    vector<uint8_t> buf;
+    uint64_t base = 0;
+    size_t have = 0;
+    ReadAhead(EnvFile& f, uint64_t sz) : file(f), file_size(sz), buf((size_t)min<uint64_t>(sz, 1 << 20)) {}
+
+    bool read(uint64_t at, void* p, size_t n) {
+        if (at >= base && at + n <= base + have) {
+            memcpy(p, buf.data() + (at - base), n);
+            return true;
+        }
+        if (n > buf.size() / 2) return file.read_at(at, p, n);
+        if (at + n > file_size) return false;
+        base = at;
+        have = (size_t)min<uint64_t>(buf.size(), file_size - at);
+        if (!file.read_at(base, buf.data(), have)) {
+            have = 0;
+            return false;
+        }
+        memcpy(p, buf.data(), n);
+        return true;
+    }
+};
+
+struct ScanResult {
+    size_t good_records = 0;
+    uint64_t last_good_offset = 0;
+    bool clean = true; // true if no truncation needed
+    bool truncated = false;
+    uint64_t padding_bytes = 0; // zero-filled (preallocated) tail, part of the cut
+    uint64_t hole_bytes = 0;    // portion of the padding that was sparse
+    bool padding_sampled = false; // padding judged from a bounded sample
+    LogFormat format;
+    uint64_t chain = 0;             // chain after the last good frame (chained logs)
+    uint64_t last_frame_offset = 0; // start of the last good frame
+    bool used_checkpoint = false;   // prefix up to `verified_from` certified by .ckpt
+    uint64_t verified_from = 0;
+    bool tail_only = false;         // only [verified_from, end) was scanned (scan_tail)
+    uint64_t first_seq = 0;         // FMT_SEQ: sequence number of the oldest record
+    uint64_t next_seq = 0;          // FMT_SEQ: sequence number for the next append
+    uint64_t head_offset = 0;       // circular logs: oldest record (tail is last_good_offset)
+    double sync_ms = 0; // time spent making the truncation durable (0 if batched)
+    uint64_t dropped_bytes = 0; // verified bytes dropped from the page cache
+};
+
+static bool truncate_file(const string& path, uint64_t new_size, Env& env = posix_env()) {
+    return env.truncate(path, new_size);
+}
+
+static void scan_circular(const string& path, const LogFormat& F, ScanResult& R, Env& env);
+static string scrub_progress_path(const string& path);
+static bool load_scrub_progress(const string& path, uint64_t& next);
+static void trim_merkle_sidecar(const string& log_path, uint64_t log_size);
+
+// When `batch` is given the truncated file is queued there and the caller
+// flushes it once for many files; otherwise the truncation is synced here.
+// Reads are paced by `limiter` when given: a scan resuming from a checkpoint
+// runs at tail priority, a full scan at full priority.
+// With `drop_cache`, verified pages are dropped from the page cache as the
+// scan advances, so recovering a large log does not evict hotter data.
+// Cuts the log back to R.last_good_offset and makes the cut durable, either
+// right away or through `batch`.
+static void cut_torn_tail(const string& path, ScanResult& R, SyncBatch* batch, Env& env = posix_env()) {
+    if (truncate_file(path, R.last_good_offset, env)) {
+        R.truncated = true;
+        uint64_t scrubbed = 0;
+        if (env.is_posix() && load_scrub_progress(path, scrubbed) && scrubbed > R.last_good_offset) {
+            ::unlink(scrub_progress_path(path).c_str()); // would land mid-frame once the log regrows
+        }
+        if (env.is_posix()) trim_merkle_sidecar(path, R.last_good_offset);
+        ostringstream msg;
+        msg << "[recover] truncated tail from offset=" << R.last_good_offset << " to size=" << R.last_good_offset << "\n";
+        if (R.padding_bytes) {
+            msg << "[recover] tail was zero padding: " << R.padding_bytes << " bytes ("
+                << R.hole_bytes << " sparse" << (R.padding_sampled ? ", sampled" : "") << ")\n";
+        }
+        {
+            lock_guard<mutex> lk(cout_mu);
+            cout << msg.str();
+        }
+        if (!env.is_posix()) {
+            if (!env.sync_file(path) || !env.sync_dir(parent_dir(path))) {
+                cerr << "[recover] sync failed; truncation may not be durable\n";
+            }
+        } else if (batch) {
+            batch->add(path);
+        } else {
+            SyncBatch local;
+            local.add(path);
+            if (!local.flush()) cerr << "[recover] sync failed; truncation may not be durable\n";
+            R.sync_ms = local.sync_ms;
+        }
+    } else {
+        cerr << "[recover] truncate failed; file may still have a torn tail\n";
+    }
+}
+
+static ScanResult scan_and_maybe_truncate(const string& path, bool perform_truncate=true,
+                                          SyncBatch* batch=nullptr, IoLimiter* limiter=nullptr,
+                                          bool drop_cache=false, Env& env=posix_env(),
+                                          bool verify_padding=false) {
+    ScanResult R;
+    uint64_t sz = 0;
+    if (!env.file_size(path, sz)) {
+        cerr << "[recover] cannot stat file\n";
+        R.clean = true;
+        return R;
+    }
+
+    unique_ptr<EnvFile> file = env.open(path, OpenMode::Read);
+    if (!file) {
+        cerr << "[recover] cannot open file\n";
+        R.clean = true;
+        return R;
+    }
+    ReadAhead f(*file, sz);
+
+    uint8_t hdr[LOG_HEADER_BYTES];
+    uint64_t hdr_n = min<uint64_t>(sz, LOG_HEADER_BYTES);
+    if (!f.read(0, hdr, hdr_n)) {
+        cerr << "[recover] cannot read header\n";
+        return R;
+    }
+    LogFormat F;
+    HeaderStatus hs = parse_log_header(hdr, hdr_n, F);
+    if (hs == HeaderStatus::Unsupported) {
+        // not a log we understand: never truncate it
+        cerr << "[recover] unsupported log header; leaving file untouched\n";
+        return R;
+    }
+    R.format = F;
+    if (F.flags & FMT_CIRCULAR) {
+        // fixed-size ring: nothing to truncate, the writer resumes at the tail
+        scan_circular(path, F, R, env);
+        return R;
+    }
+
+    uint64_t off = F.data_start();
+    uint64_t chain = 0;
+    vector<uint8_t> body;
+    // Reads and checks the frame at `off`; on success sets `len` and `fi`.
+    // Returns false for a missing, torn or corrupt frame.
+    auto read_frame = [&](uint64_t at, uint32_t& len, FrameInfo& fi) {
+        uint32_t len_be = 0;
+        if (at + 4 > sz || !f.read(at, &len_be, 4)) return false;
+        len = from_be32(len_be);
+        if (!len_plausible(len) || at + F.frame_size(len) > sz) return false;
+        body.resize(F.ext_bytes() + len + 4);
+        if (!f.read(at + 4, body.data(), body.size())) return false;
+        return check_frame_body(F, body.data(), len, fi);
+    };
+
+    // a trimmed log starts at its persisted logical start; the first frame's
+    // stored chain is adopted since the frames it covers are gone
+    LogStart LS;
+    bool adopt_chain = false;
+    if (hs == HeaderStatus::Ok && load_log_start(path, LS, env)) {
+        uint32_t len = 0;
+        FrameInfo fi;
+        if (LS.pending_collapse && LS.offset >= LS.pending_collapse &&
+            read_frame(LS.offset - LS.pending_collapse, len, fi)) {
+            LS.offset -= LS.pending_collapse; // crashed after the collapse itself
+        }
+        if (LS.offset >= off && LS.offset <= sz) {
+            off = LS.offset;
+            adopt_chain = true;
+        }
+        R.first_seq = LS.lsn;
+    }
+    uint64_t start_off = off;
+    R.head_offset = off;
+
+    if (hs == HeaderStatus::Torn) {
+        R.clean = false; // crashed while creating the log
+        off = 0;
+    } else if (F.flags & FMT_CHAINED) {
+        Checkpoint C;
+        if (load_checkpoint(path, C, env) && C.offset <= sz && C.offset >= start_off) {
+            uint32_t len = 0;
+            FrameInfo fi;
+            bool ok = C.records == 0
+                ? (C.offset == F.data_start() && C.chain == 0)
+                : (read_frame(C.last_frame, len, fi) &&
+                   C.last_frame + F.frame_size(len) == C.offset &&
+                   chain_next(fi.chain, fi.crc, len) == C.chain);
+            if (ok) {
+                off = C.offset;
+                chain = C.chain;
+                adopt_chain = false;
+                if (C.records > 0) R.next_seq = fi.seq + 1;
+                if ((F.flags & FMT_SEQ) && C.records > 0 && read_frame(start_off, len, fi)) R.first_seq = fi.seq;
+                R.good_records = C.records;
+                R.last_frame_offset = C.last_frame;
+                R.used_checkpoint = true;
+                R.verified_from = off;
+            } else {
+                cerr << "[recover] checkpoint does not match log; full scan\n";
+            }
+        }
+    }
+    R.last_good_offset = off;
+    R.chain = chain;
+
+    IoPriority prio = R.used_checkpoint ? IoPriority::Tail : IoPriority::Full;
+    const uint64_t IO_GRANULE = 256 * 1024;
+    uint64_t pending_io = 0;
+    // fadvise applies to the file, so a separate fd serves the ifstream's pages
+    int cache_fd = drop_cache && env.is_posix() ? ::open(path.c_str(), O_RDONLY) : -1;
+    uint64_t dropped_to = off;
+    while (R.clean) {
+        if (off + 4 > sz) { // no room for len
+            if (off < sz) R.clean = false; // a few stray bytes
+            break;
+        }
+        uint32_t len = 0;
+        FrameInfo fi;
+        if (!read_frame(off, len, fi)) {
+            // implausible length, partial tail or CRC mismatch -> cut at off
+            R.clean = false;
+            if (len == 0) {
+                // likely a preallocated/extended tail: account for it as padding
+                ZeroTail Z = check_zero_tail(path, off, sz, env, verify_padding ? UINT64_MAX : ZERO_PROBE_BYTES);
+                R.padding_bytes = Z.padding_bytes;
+                R.hole_bytes = Z.hole_bytes;
+                R.padding_sampled = Z.sampled;
+            }
+            break;
+        }
+        if (adopt_chain) {
+            chain = fi.chain;
+            adopt_chain = false;
+        }
+        if (F.flags & FMT_CHAINED) {
+            if (fi.chain != chain) {
+                // valid frame from another history (e.g. stale recycled data)
+                R.clean = false;
+                break;
+            }
+            chain = chain_next(chain, fi.crc, len);
+        }
+        if (F.flags & FMT_SEQ) {
+            // numbers only need to increase (striped logs hold a subset of them)
+            if (R.good_records == 0) {
+                R.first_seq = fi.seq;
+            } else if (fi.seq < R.next_seq) {
+                R.clean = false; // stale frame from an older history
+                break;
+            }
+            R.next_seq = fi.seq + 1;
+        }
+        // good record
+        R.last_frame_offset = off;
+        off += F.frame_size(len);
+        R.good_records++;
+        R.last_good_offset = off;
+        R.chain = chain;
+        if (limiter) {
+            pending_io += F.frame_size(len);
+            if (pending_io >= IO_GRANULE) { limiter->acquire(pending_io, prio); pending_io = 0; }
+        }
+        if (cache_fd >= 0 && off - dropped_to >= (4u << 20)) {
+            R.dropped_bytes += drop_cached(cache_fd, dropped_to, off);
+            dropped_to = off & ~uint64_t(4095);
+        }
+        if (off == sz) break; // exact end
+    }
+    if (!(F.flags & FMT_SEQ)) R.next_seq = R.first_seq + R.good_records; // LSN = ordinal
+    else if (R.good_records == 0) R.next_seq = max(R.next_seq, R.first_seq);
+    if (limiter && pending_io > 0) limiter->acquire(pending_io, prio);
+    if (cache_fd >= 0) {
+        R.dropped_bytes += drop_cached(cache_fd, dropped_to, R.last_good_offset);
+        ::close(cache_fd);
+    }
+
+    if (!R.clean && perform_truncate) cut_torn_tail(path, R, batch, env);
+    return R;
+}
+
+// ----------- Merkle sidecar -----------
+// `<log>.merkle` holds one u64 hash per full fixed-size block of the log
+// file (raw bytes, header included), after a small header: "WMRK" + u32
+// block size. Nodes are stored in post-order, as in a Merkle mountain range:
+// leaf i is followed by the ctz(i + 1) parents it completes, so appending a
+// block only appends to the file, n leaves always occupy 2n - popcount(n)
+// nodes and dropping trailing leaves is a truncate. The trailing partial
+// block is not a leaf yet and stays covered by frame CRCs.
+static const uint32_t MERKLE_MAGIC = 0x574D524B; // "WMRK"
+static const uint32_t MERKLE_BLOCK = 64 * 1024;
+static const uint64_t MERKLE_HEADER_BYTES = 8;
+static const uint64_t MERKLE_MISSING = 0x6D697373696E6721ull; // pad for absent leaves
+
+static string merkle_path(const string& path) { return path + ".merkle"; }
+
+static inline uint64_t merkle_parent(uint64_t l, uint64_t r) {
+    return mix64(l * 0x9E3779B97F4A7C15ull ^ rotl64(r, 29));
+}
+
+static inline uint64_t merkle_node_count(uint64_t leaves) {
+    return 2 * leaves - (uint64_t)__builtin_popcountll(leaves);
+}
+
+// Position of the node of height `h` whose leftmost leaf is `j`.
+static inline uint64_t merkle_node_pos(uint64_t j, unsigned h) {
+    uint64_t last = j + (1ull << h) - 1;
+    return merkle_node_count(last) + h;
+}
+
+// Appends leaf number `index` and the parents it completes to `nodes`;
+// `peaks` holds the roots of the complete subtrees so far, oldest first.
+static void merkle_push(vector<uint64_t>& peaks, uint64_t index, uint64_t leaf, vector<uint64_t>& nodes) {
+    nodes.push_back(leaf);
+    peaks.push_back(leaf);
+    for (uint64_t k = index + 1; (k & 1) == 0; k >>= 1) {
+        uint64_t r = peaks.back();
+        peaks.pop_back();
+        peaks.back() = merkle_parent(peaks.back(), r);
+        nodes.push_back(peaks.back());
+    }
+}
+
+static bool load_merkle_nodes(const string& sidecar, uint32_t& block_size, vector<uint64_t>& nodes) {
+    ifstream f(sidecar, ios::binary);
+    uint8_t hdr[MERKLE_HEADER_BYTES];
+    if (!f || !read_exact(f, hdr, sizeof hdr) || load_be32(hdr) != MERKLE_MAGIC) return false;
+    block_size = load_be32(hdr + 4);
+    if (block_size == 0) return false;
+    nodes.clear();
+    uint8_t b[8];
+    while (read_exact(f, b, 8)) nodes.push_back(load_be64(b));
+    return true;
+}
+
+// Leaves whose parents are all present; a crash between appending a leaf
+// and its parents leaves a short group at the end, which is ignored.
+static vector<uint64_t> merkle_leaves_of(const vector<uint64_t>& nodes) {
+    vector<uint64_t> leaves;
+    for (uint64_t pos = 0, i = 0;; ++i) {
+        uint64_t group = 1 + (uint64_t)__builtin_ctzll(i + 1);
+        if (pos + group > nodes.size()) break;
+        leaves.push_back(nodes[pos]);
+        pos += group;
+    }
+    return leaves;
+}
+
+static bool load_merkle_leaves(const string& sidecar, uint32_t& block_size, vector<uint64_t>& leaves) {
+    vector<uint64_t> nodes;
+    if (!load_merkle_nodes(sidecar, block_size, nodes)) return false;
+    leaves = merkle_leaves_of(nodes);
+    return true;
+}
+
+// Incremental builder used by WalWriter: bytes are fed as they are appended
+// and a leaf (with the parents it completes) is written whenever a block
+// fills up.
+struct MerkleSidecar {
+    string path;
+    uint32_t block_size = MERKLE_BLOCK;
+    vector<uint64_t> leaves;
+    vector<uint64_t> peaks;
+    vector<uint8_t> partial; // current, not yet full block
+    ofstream out;
+
+    // Opens or creates the sidecar for `log_path` and reconciles it with the
+    // log's first `log_size` bytes: leaves at or past the end of the log
+    // (left over from a truncated tail) are dropped, missing ones are hashed
+    // from the log. A sidecar whose nodes are all still valid is only
+    // truncated; anything else is replaced via tmp + rename.
+    bool open(const string& log_path, uint64_t log_size, uint32_t bs = MERKLE_BLOCK) {
+        path = merkle_path(log_path);
+        block_size = bs;
+        uint32_t have_bs = 0;
+        vector<uint64_t> stored;
+        if (!load_merkle_nodes(path, have_bs, stored) || have_bs != bs) {
+            have_bs = 0;
+            stored.clear();
+        }
+        leaves = merkle_leaves_of(stored);
+        uint64_t full = log_size / bs;
+        if (leaves.size() > full) leaves.resize(full);
+        vector<uint64_t> nodes;
+        peaks.clear();
+        for (uint64_t i = 0; i < leaves.size(); ++i) merkle_push(peaks, i, leaves[i], nodes);
+        if (have_bs && stored.size() >= nodes.size() && equal(nodes.begin(), nodes.end(), stored.begin())) {
+            if (stored.size() > nodes.size() &&
+                ::truncate(path.c_str(), (off_t)(MERKLE_HEADER_BYTES + 8 * nodes.size())) != 0) {
+                return false;
+            }
+        } else {
+            vector<uint8_t> img(MERKLE_HEADER_BYTES + 8 * nodes.size());
+            store_be32(img.data(), MERKLE_MAGIC);
+            store_be32(img.data() + 4, bs);
+            for (size_t i = 0; i < nodes.size(); ++i) store_be64(img.data() + MERKLE_HEADER_BYTES + 8 * i, nodes[i]);
+            if (!posix_env().replace_file(path, img.data(), img.size())) return false;
+        }
+        out.open(path, ios::binary | ios::app);
+        if (!out) return false;
+        // catch up from the first block without a leaf
+        ifstream log(log_path, ios::binary);
+        if (!log) return false;
+        uint64_t pos = (uint64_t)leaves.size() * bs;
+        log.seekg(pos);
+        vector<uint8_t> buf(bs);
+        while (pos < log_size) {
+            size_t n = (size_t)min<uint64_t>(bs, log_size - pos);
+            if (!read_exact(log, buf.data(), n) || !feed(buf.data(), n)) return false;
+            pos += n;
+        }
+        return true;
+    }
+
+    bool feed(const uint8_t* p, size_t n) {
+        vector<uint64_t> nodes;
+        while (n > 0) {
+            size_t take = min<size_t>(n, block_size - partial.size());
+            partial.insert(partial.end(), p, p + take);
+            p += take;
+            n -= take;
+            if (partial.size() == block_size) {
+                uint64_t h = hash64(partial.data(), partial.size());
+                nodes.clear();
+                merkle_push(peaks, leaves.size(), h, nodes);
+                uint8_t b[8];
+                for (uint64_t x : nodes) {
+                    store_be64(b, x);
+                    if (!write_all(out, b, 8)) return false;
+                }
+                leaves.push_back(h);
+                partial.clear();
+            }
+        }
+        out.flush();
+        return bool(out);
+    }
+
+    bool sync() {
+        out.flush();
+        return out && fsync_path(path);
+    }
+};
+
+// Drops the leaves of `log_path`'s sidecar at or past `log_size`; used when
+// recovery cuts the log, so stale leaves are not trusted once it regrows.
+static void trim_merkle_sidecar(const string& log_path, uint64_t log_size) {
+    uint32_t bs = 0;
+    vector<uint64_t> nodes;
+    if (!load_merkle_nodes(merkle_path(log_path), bs, nodes)) return;
+    uint64_t keep = merkle_node_count(min<uint64_t>(merkle_leaves_of(nodes).size(), log_size / bs));
+    if (keep < nodes.size()) {
+        int rc = ::truncate(merkle_path(log_path).c_str(), (off_t)(MERKLE_HEADER_BYTES + 8 * keep));
+        (void)rc; // a stale sidecar is still reconciled on the next open
+    }
+}
+
+// levels[0] are the leaves, levels.back() is the single root.
+struct MerkleTree {
+    vector<vector<uint64_t>> levels;
+    explicit MerkleTree(vector<uint64_t> leaves) {
+        if (leaves.empty()) leaves.push_back(MERKLE_MISSING);
+        levels.push_back(std::move(leaves));
+        while (levels.back().size() > 1) {
+            const auto& cur = levels.back();
+            vector<uint64_t> up((cur.size() + 1) / 2);
+            for (size_t i = 0; i < up.size(); ++i) {
+                up[i] = merkle_parent(cur[2 * i], 2 * i + 1 < cur.size() ? cur[2 * i + 1] : MERKLE_MISSING);
+            }
+            levels.push_back(std::move(up));
+        }
+    }
+    uint64_t root() const { return levels.back()[0]; }
+};
+
+struct MerkleDiffResult {
+    uint32_t block_size = 0;
+    uint64_t leaves_a = 0, leaves_b = 0;
+    uint64_t nodes_read = 0;
+    vector<uint64_t> blocks; // sorted
+};
+
+// Blocks that differ between two sidecars. The common prefix is split into
+// the complete subtrees both files hold; each pair of roots is compared and
+// only subtrees whose hashes differ are descended into, reading single
+// nodes with pread: O(d log n) reads for d differing blocks. Leaves only
+// one side has are reported as differing.
+static bool merkle_diff(const string& sidecar_a, const string& sidecar_b, MerkleDiffResult& D) {
+    struct Side { int fd = -1; uint32_t bs = 0; uint64_t leaves = 0; };
+    Side s[2];
+    const string* names[2] = {&sidecar_a, &sidecar_b};
+    bool ok = true;
+    for (int k = 0; k < 2 && ok; ++k) {
+        s[k].fd = ::open(names[k]->c_str(), O_RDONLY);
+        uint8_t hdr[MERKLE_HEADER_BYTES];
+        struct stat st;
+        ok = s[k].fd >= 0 && ::pread(s[k].fd, hdr, sizeof hdr, 0) == (ssize_t)sizeof hdr &&
+             load_be32(hdr) == MERKLE_MAGIC && (s[k].bs = load_be32(hdr + 4)) != 0 && ::fstat(s[k].fd, &st) == 0;
+        if (!ok) break;
+        uint64_t nodes = ((uint64_t)st.st_size - MERKLE_HEADER_BYTES) / 8;
+        // largest leaf count whose nodes are all present
+        uint64_t lo = 0, hi = nodes;
+        while (lo < hi) {
+            uint64_t mid = (lo + hi + 1) / 2;
+            if (merkle_node_count(mid) <= nodes) lo = mid; else hi = mid - 1;
+        }
+        s[k].leaves = lo;
+    }
+    if (!ok) cerr << "[merkle] missing sidecar\n";
+    else if (s[0].bs != s[1].bs) { cerr << "[merkle] block sizes differ\n"; ok = false; }
+    if (ok) {
+        D.block_size = s[0].bs;
+        D.leaves_a = s[0].leaves;
+        D.leaves_b = s[1].leaves;
+        auto node = [&](int k, uint64_t j, unsigned h, uint64_t& v) {
+            uint8_t b[8];
+            ++D.nodes_read;
+            off_t off = (off_t)(MERKLE_HEADER_BYTES + 8 * merkle_node_pos(j, h));
+            if (::pread(s[k].fd, b, 8, off) != 8) return false;
+            v = load_be64(b);
+            return true;
+        };
+        uint64_t common = min(D.leaves_a, D.leaves_b);
+        vector<pair<uint64_t, unsigned>> stack; // (leftmost leaf, height)
+        for (uint64_t j = 0, rest = common; rest; ) {
+            unsigned h = 63 - (unsigned)__builtin_clzll(rest);
+            stack.push_back({j, h});
+            j += 1ull << h;
+            rest -= 1ull << h;
+        }
+        reverse(stack.begin(), stack.end());
+        while (ok && !stack.empty()) {
+            auto [j, h] = stack.back();
+            stack.pop_back();
+            uint64_t x = 0, y = 0;
+            if (!node(0, j, h, x) || !node(1, j, h, y)) { ok = false; break; }
+            if (x == y) continue;
+            if (h == 0) { D.blocks.push_back(j); continue; }
+            stack.push_back({j + (1ull << (h - 1)), h - 1});
+            stack.push_back({j, h - 1});
+        }
+        if (!ok) cerr << "[merkle] read failed\n";
+        for (uint64_t i = common; i < max(D.leaves_a, D.leaves_b); ++i) D.blocks.push_back(i);
+    }
+    for (auto& x : s) if (x.fd >= 0) ::close(x.fd);
+    return ok;
+}
+
+struct MerkleVerifyResult {
+    uint32_t block_size = 0;
+    uint64_t blocks = 0;          // leaves checked
+    uint64_t uncovered_bytes = 0; // log bytes after the last leaf
+    uint64_t trimmed_blocks = 0;  // leaves wholly before the logical start
+    vector<uint64_t> bad_blocks;
+    uint64_t root = 0;
+};
+
+// Re-hashes every covered block of `log_path` on `threads` threads (blocks
+// are claimed in batches from a shared counter) and compares with the sidecar.
+static bool merkle_verify(const string& log_path, unsigned threads, MerkleVerifyResult& V) {
+    vector<uint64_t> leaves;
+    if (!load_merkle_leaves(merkle_path(log_path), V.block_size, leaves)) {
+        cerr << "[merkle] no sidecar for " << log_path << "\n";
+        return false;
+    }
+    uint64_t sz = fs::file_size(log_path);
+    uint64_t full = sz / V.block_size;
+    V.blocks = leaves.size();
+    if (full < leaves.size()) {
+        // sidecar claims blocks the log no longer has
+        for (uint64_t i = full; i < leaves.size(); ++i) V.bad_blocks.push_back(i);
+        V.blocks = full;
+    }
+    V.uncovered_bytes = sz - V.blocks * V.block_size;
+    V.root = MerkleTree(leaves).root();
+    LogStart LS;
+    if (load_log_start(log_path, LS)) V.trimmed_blocks = min(V.blocks, LS.offset / V.block_size); // punched
+
+    const uint64_t BATCH = 16;
+    atomic<uint64_t> next{V.trimmed_blocks};
+    vector<vector<uint64_t>> bad(max(1u, threads));
+    vector<thread> workers;
+    for (unsigned t = 0; t < bad.size(); ++t) {
+        workers.emplace_back([&, t] {
+            int fd = ::open(log_path.c_str(), O_RDONLY);
+            if (fd < 0) return;
+            vector<uint8_t> buf(V.block_size);
+            for (;;) {
+                uint64_t first = next.fetch_add(BATCH);
+                if (first >= V.blocks) break;
+                uint64_t last = min(V.blocks, first + BATCH);
+                for (uint64_t i = first; i < last; ++i) {
+                    ssize_t r = ::pread(fd, buf.data(), V.block_size, (off_t)(i * V.block_size));
+                    if (r != (ssize_t)V.block_size || hash64(buf.data(), V.block_size) != leaves[i]) {
+                        bad[t].push_back(i);
+                    }
+                }
+            }
+            ::close(fd);
+        });
+    }
+    for (auto& w : workers) w.join();
+    for (const auto& b : bad) V.bad_blocks.insert(V.bad_blocks.end(), b.begin(), b.end());
+    sort(V.bad_blocks.begin(), V.bad_blocks.end());
+    return true;
+}
+
+// Prints sorted block indices as coalesced [first, last] ranges.
+static void print_block_ranges(const char* tag, const vector<uint64_t>& blocks, uint32_t block_size) {
+    for (size_t i = 0; i < blocks.size();) {
+        size_t j = i;
+        while (j + 1 < blocks.size() && blocks[j + 1] == blocks[j] + 1) ++j;
+        cout << tag << " blocks " << blocks[i] << ".." << blocks[j] << " (bytes "
+             << blocks[i] * block_size << ".." << (blocks[j] + 1) * block_size << ")\n";
+        i = j + 1;
+    }
+}
+
+// ----------- Time index -----------
+// Logs created with FMT_TIME stamp every frame with the wall-clock time of
+// its append. `<log>.tidx` maps time to position: "WTIX" + u32 K, then an
+// entry [u64 ts][u64 offset][u64 lsn] for every K-th record the writer
+// appends. Timestamps never decrease within a log, so the entries are sorted
+// and a reader seeks by binary search. The sidecar is advisory and not
+// fsynced: readers check the frame an entry points at and fall back to a
+// scan from the log start when it does not match.
+static const uint32_t TIDX_MAGIC = 0x57544958; // "WTIX"
+static const uint32_t TIDX_EVERY = 256;
+static const uint64_t TIDX_HEADER_BYTES = 8, TIDX_ENTRY_BYTES = 24;
+
+struct TimeIndexEntry {
+    uint64_t ts = 0, offset = 0, lsn = 0;
+};
+
+static uint64_t wall_clock_us() {
+    return (uint64_t)chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static string time_index_path(const string& path) { return path + ".tidx"; }
+
+static bool load_time_index(const string& sidecar, vector<TimeIndexEntry>& entries) {
+    ifstream f(sidecar, ios::binary);
+    uint8_t hdr[TIDX_HEADER_BYTES];
+    if (!f || !read_exact(f, hdr, sizeof hdr) || load_be32(hdr) != TIDX_MAGIC) return false;
+    entries.clear();
+    uint8_t b[TIDX_ENTRY_BYTES];
+    while (read_exact(f, b, sizeof b)) entries.push_back({load_be64(b), load_be64(b + 8), load_be64(b + 16)});
+    return true;
+}
+
+// Maintained by WalWriter for FMT_TIME logs.
+struct TimeIndexSidecar {
+    string path;
+    uint32_t every = TIDX_EVERY;
+    uint64_t since_entry = 0; // records appended since the last entry
+    vector<TimeIndexEntry> entries;
+    ofstream out;
+
+    // Opens or creates the sidecar for a log whose live frames are in
+    // [start, end): entries outside it (a truncated tail, a trimmed head) or
+    // out of order are dropped. After a collapse `shift` bytes were removed
+    // before `start`, so surviving offsets move down by that much.
+    bool open(const string& log_path, uint64_t start, uint64_t end, uint64_t shift = 0) {
+        path = time_index_path(log_path);
+        vector<TimeIndexEntry> old;
+        load_time_index(path, old);
+        entries.clear();
+        for (auto e : old) {
+            if (e.offset < shift) continue;
+            e.offset -= shift;
+            if (e.offset < start || e.offset >= end) continue;
+            if (!entries.empty() && (e.ts < entries.back().ts || e.offset <= entries.back().offset)) continue;
+            entries.push_back(e);
+        }
+        {
+            ofstream f(path, ios::binary | ios::trunc);
+            uint8_t hdr[TIDX_HEADER_BYTES];
+            store_be32(hdr, TIDX_MAGIC);
+            store_be32(hdr + 4, every);
+            if (!f || !write_all(f, hdr, sizeof hdr)) return false;
+            for (const auto& e : entries) {
+                if (!write_entry(f, e)) return false;
+            }
+        }
+        out.open(path, ios::binary | ios::app);
+        since_entry = every; // the next record starts a new stretch
+        return bool(out);
+    }
+
+    static bool write_entry(ofstream& f, const TimeIndexEntry& e) {
+        uint8_t b[TIDX_ENTRY_BYTES];
+        store_be64(b, e.ts);
+        store_be64(b + 8, e.offset);
+        store_be64(b + 16, e.lsn);
+        return write_all(f, b, sizeof b);
+    }
+
+    // Called for every appended record; writes an entry every `every` records.
+    bool note(uint64_t ts, uint64_t offset, uint64_t lsn) {
+        if (since_entry++ < every) return true;
+        since_entry = 1;
+        entries.push_back({ts, offset, lsn});
+        return write_entry(out, entries.back());
+    }
+
+    bool flush() {
+        out.flush();
+        return bool(out);
+    }
+};
+
+// ----------- Snapshots (bounded replay) -----------
+// `<log>.snap.<lsn as 16 hex digits>` holds application state covering every
+// record with LSN < lsn: [u32 "WSNP"][u64 lsn][u64 len][state][u64 hash].
+// Recovery restores the newest valid snapshot and replays only the records
+// after it, so restart time is bounded by the snapshot interval; the log
+// before the snapshot can then be trimmed.
+static const uint32_t SNAP_MAGIC = 0x57534E50; // "WSNP"
+
+struct Snapshot {
+    uint64_t lsn = 0;
+    vector<uint8_t> state;
+};
+
+static string snapshot_path(const string& path, uint64_t lsn) {
+    char hex[17];
+    snprintf(hex, sizeof hex, "%016llx", (unsigned long long)lsn);
+    return path + ".snap." + hex;
+}
+
+// Snapshot files of `path` as (lsn, file), newest first.
+static vector<pair<uint64_t, string>> list_snapshots(const string& path) {
+    vector<pair<uint64_t, string>> out;
+    string prefix = fs::path(path).filename().string() + ".snap.";
+    error_code ec;
+    for (const auto& e : fs::directory_iterator(parent_dir(path), ec)) {
+        string name = e.path().filename().string();
+        if (name.size() != prefix.size() + 16 || name.compare(0, prefix.size(), prefix) != 0) continue;
+        char* end = nullptr;
+        uint64_t lsn = strtoull(name.c_str() + prefix.size(), &end, 16);
+        if (*end == '\0') out.emplace_back(lsn, e.path().string());
+    }
+    sort(out.rbegin(), out.rend());
+    return out;
+}
+
+static bool store_snapshot(const string& path, uint64_t lsn, const uint8_t* state, size_t n) {
+    vector<uint8_t> b(20 + n + 8);
+    store_be32(b.data(), SNAP_MAGIC);
+    store_be64(b.data() + 4, lsn);
+    store_be64(b.data() + 12, n);
+    if (n) memcpy(b.data() + 20, state, n);
+    store_be64(b.data() + 20 + n, hash64(b.data(), 20 + n));
+    string final_path = snapshot_path(path, lsn), tmp = final_path + ".tmp";
+    {
+        ofstream f(tmp, ios::binary | ios::trunc);
+        if (!f || !write_all(f, b.data(), b.size())) return false;
+    }
+    if (!fsync_path(tmp) || ::rename(tmp.c_str(), final_path.c_str()) != 0) return false;
+    return fsync_path(parent_dir(path));
+}
+
+static bool load_snapshot_file(const string& file, Snapshot& S) {
+    ifstream f(file, ios::binary);
+    uint8_t h[20];
+    if (!f || !read_exact(f, h, sizeof h) || load_be32(h) != SNAP_MAGIC) return false;
+    uint64_t n = load_be64(h + 12);
+    uint64_t sz = 0;
+    try { sz = fs::file_size(file); } catch (...) { return false; }
+    if (n != sz - min<uint64_t>(sz, 28)) return false;
+    vector<uint8_t> b(20 + n + 8);
+    memcpy(b.data(), h, 20);
+    if (!read_exact(f, b.data() + 20, n + 8) || load_be64(b.data() + 20 + n) != hash64(b.data(), 20 + n)) return false;
+    S.lsn = load_be64(h + 4);
+    S.state.assign(b.begin() + 20, b.begin() + 20 + n);
+    return true;
+}
+
+// Newest snapshot that verifies; damaged ones are reported and skipped.
+static bool load_newest_snapshot(const string& path, Snapshot& S) {
+    for (const auto& c : list_snapshots(path)) {
+        if (load_snapshot_file(c.second, S) && S.lsn == c.first) return true;
+        cerr << "[snapshot] ignoring damaged " << c.second << "\n";
+    }
+    return false;
+}
+
+// Removes snapshots older than `lsn` once a newer one is durable.
+static void remove_snapshots_before(const string& path, uint64_t lsn) {
+    for (const auto& c : list_snapshots(path)) {
+        if (c.first < lsn) ::unlink(c.second.c_str());
+    }
+}
+
+struct ReplayStats {
+    bool from_snapshot = false;
+    uint64_t snapshot_lsn = 0;
+    uint64_t replayed = 0; // records passed to apply
+    uint64_t skipped = 0;  // records already covered by the snapshot
+    uint64_t next_lsn = 0;
+    double ms = 0;
+};
+
+using ApplyFn = function<bool(uint64_t lsn, const uint8_t* payload, uint32_t len)>;
+
+// Pull-style reader over the intact frames of a log: open() scans it (no
+// truncation) to find the live range, next() steps frame by frame. With
+// `headers_only` the payload is skipped and not checked (CRC included), for
+// passes that only need sequence numbers and offsets.
+struct FrameCursor {
+    ScanResult scan;
+    LogFormat F;
+    ifstream f;
+    bool headers_only = false;
+    uint64_t off = 0, end = 0;
+    uint64_t frame_offset = 0; // offset of the current frame
+    uint64_t lsn = 0;          // LSN of the current frame
+    uint64_t next_ordinal = 0; // LSN of the next frame for logs without FMT_SEQ
+    uint32_t len = 0;
+    vector<uint8_t> body;      // [ext][payload][crc] of the current frame
+
+    // Reuses `known` when the caller has just scanned (and recovered) the log.
+    bool open(const string& path, bool headers = false, const ScanResult* known = nullptr) {
+        scan = known ? *known : scan_and_maybe_truncate(path, /*perform_truncate=*/false);
+        F = scan.format;
+        if (F.flags & FMT_CIRCULAR) {
+            cerr << "[replay] circular logs are not supported\n";
+            return false;
+        }
+        headers_only = headers;
+        off = scan.head_offset;
+        end = scan.last_good_offset;
+        next_ordinal = scan.first_seq;
+        f.open(path, ios::binary);
+        f.seekg(off);
+        return (bool)f;
+    }
+
+    // Advances to the next frame; false at the end of the live range or when
+    // the file changed under the cursor.
+    bool next() {
+        if (off >= end) return false;
+        uint8_t lb[4];
+        if (!read_exact(f, lb, 4)) return false;
+        len = load_be32(lb);
+        if (headers_only) {
+            body.resize(F.ext_bytes());
+            if (!read_exact(f, body.data(), body.size())) return false;
+            f.seekg(len + 4, ios::cur);
+            lsn = (F.flags & FMT_SEQ) ? load_be64(body.data() + F.seq_offset()) : next_ordinal;
+        } else {
+            body.resize(F.ext_bytes() + len + 4);
+            FrameInfo fi;
+            if (!read_exact(f, body.data(), body.size()) || !check_frame_body(F, body.data(), len, fi)) return false;
+            lsn = (F.flags & FMT_SEQ) ? fi.seq : next_ordinal;
+        }
+        next_ordinal = lsn + 1;
+        frame_offset = off;
+        off += F.frame_size(len);
+        return true;
+    }
+
+    const uint8_t* payload() const { return body.data() + F.ext_bytes(); }
+};
+
+// Calls `apply` for every record with LSN >= `from_lsn`, in log order. The
+// log should already be recovered; reading stops at the first bad frame.
+// Fails if the log was trimmed past `from_lsn` (records would be missing).
+static bool replay_log(const string& path, uint64_t from_lsn, const ApplyFn& apply, ReplayStats& st) {
+    auto t0 = chrono::steady_clock::now();
+    FrameCursor c;
+    if (!c.open(path)) return false;
+    if (c.scan.head_offset > c.F.data_start() && c.scan.first_seq > from_lsn) {
+        cerr << "[replay] log starts at lsn " << c.scan.first_seq << " but replay needs lsn " << from_lsn << "\n";
+        return false;
+    }
+    while (c.next()) {
+        if (c.lsn < from_lsn) {
+            st.skipped++;
+        } else {
+            if (!apply(c.lsn, c.payload(), c.len)) return false;
+            st.replayed++;
+        }
+    }
+    if (c.off < c.end) return false;
+    st.next_lsn = max(c.next_ordinal, c.scan.next_seq);
+    st.ms = ms_since(t0);
+    return true;
+}
+
+// Restores the newest valid snapshot (if any) and replays the records after it.
+static bool replay_from_snapshot(const string& path, const function<bool(const Snapshot&)>& restore,
+                                 const ApplyFn& apply, ReplayStats& st) {
+    Snapshot S;
+    uint64_t from = 0;
+    if (load_newest_snapshot(path, S)) {
+        if (!restore(S)) return false;
+        st.from_snapshot = true;
+        st.snapshot_lsn = from = S.lsn;
+    }
+    return replay_log(path, from, apply, st);
+}
+
+// ----------- Parallel replay -----------
+// Replay is partitioned by key: the reader thread scans the log (replay_log)
+// and routes each record to worker hash(key) % workers in batches, so every
+// key's records are applied in log order by one thread while different keys
+// proceed in parallel. A record without a key is a barrier: all workers
+// drain first, then it is applied on the reader thread with shard ALL_SHARDS.
+static const unsigned ALL_SHARDS = ~0u;
+
+// Sets `key`/`klen` to the record's key; false for records without one.
+using KeyFn = function<bool(const uint8_t* payload, uint32_t len, const uint8_t*& key, size_t& klen)>;
+using ShardApplyFn = function<bool(unsigned shard, uint64_t lsn, const uint8_t* payload, uint32_t len)>;
+
+struct ReplayBatch {
+    vector<uint8_t> data;
+    vector<pair<uint64_t, uint32_t>> recs; // (lsn, len); payloads are back to back in `data`
+};
+
+// Bounded hand-off from the reader to one worker; `busy` counts batches
+// queued or being applied, so a barrier can wait for the worker to drain.
+struct BatchQueue {
+    mutex mu;
+    condition_variable cv;
+    deque<ReplayBatch> q;
+    size_t busy = 0;
+    bool done = false;
+    static const size_t CAP = 8;
+
+    void push(ReplayBatch&& b) {
+        unique_lock<mutex> lk(mu);
+        cv.wait(lk, [&] { return q.size() < CAP; });
+        q.push_back(std::move(b));
+        busy++;
+        cv.notify_all();
+    }
+    bool pop(ReplayBatch& b) {
+        unique_lock<mutex> lk(mu);
+        cv.wait(lk, [&] { return !q.empty() || done; });
+        if (q.empty()) return false;
+        b = std::move(q.front());
+        q.pop_front();
+        cv.notify_all();
+        return true;
+    }
+    void finished() {
+        lock_guard<mutex> lk(mu);
+        busy--;
+        cv.notify_all();
+    }
+    void drain() {
+        unique_lock<mutex> lk(mu);
+        cv.wait(lk, [&] { return busy == 0; });
+    }
+    void close() {
+        lock_guard<mutex> lk(mu);
+        done = true;
+        cv.notify_all();
+    }
+};
+
+struct ParallelReplayStats {
+    ReplayStats replay;
+    uint64_t batches = 0;
+    uint64_t barriers = 0;
+    vector<uint64_t> per_worker; // records applied by each worker
+};
+
+static bool parallel_replay(const string& path, uint64_t from_lsn, unsigned workers, const KeyFn& key_of,
+                            const ShardApplyFn& apply, ParallelReplayStats& st) {
+    workers = max(1u, workers);
+    const size_t BATCH_RECS = 1024, BATCH_BYTES = 1 << 20;
+    vector<BatchQueue> queues(workers);
+    vector<ReplayBatch> pending(workers);
+    st.per_worker.assign(workers, 0);
+    atomic<bool> failed{false};
+    vector<thread> threads;
+    for (unsigned w = 0; w < workers; ++w) {
+        threads.emplace_back([&, w] {
+            ReplayBatch b;
+            while (queues[w].pop(b)) {
+                const uint8_t* p = b.data.data();
+                for (const auto& r : b.recs) {
+                    if (!failed.load(memory_order_relaxed) && !apply(w, r.first, p, r.second)) failed = true;
+                    p += r.second;
+                }
+                st.per_worker[w] += b.recs.size();
+                queues[w].finished();
+            }
+        });
+    }
+    auto flush = [&](unsigned w) {
+        if (pending[w].recs.empty()) return;
+        queues[w].push(std::move(pending[w]));
+        pending[w] = ReplayBatch();
+        st.batches++;
+    };
+    bool ok = replay_log(path, from_lsn, [&](uint64_t lsn, const uint8_t* p, uint32_t n) {
+        if (failed) return false;
+        const uint8_t* key = nullptr;
+        size_t klen = 0;
+        if (!key_of(p, n, key, klen)) {
+            for (unsigned w = 0; w < workers; ++w) flush(w);
+            for (auto& q : queues) q.drain();
+            st.barriers++;
+            return apply(ALL_SHARDS, lsn, p, n);
+        }
+        unsigned w = (unsigned)(hash64(key, klen) % workers);
+        ReplayBatch& b = pending[w];
+        b.data.insert(b.data.end(), p, p + n);
+        b.recs.emplace_back(lsn, n);
+        if (b.recs.size() >= BATCH_RECS || b.data.size() >= BATCH_BYTES) flush(w);
+        return true;
+    }, st.replay);
+    for (unsigned w = 0; w < workers; ++w) {
+        if (ok) flush(w);
+        queues[w].close();
+    }
+    for (auto& t : threads) t.join();
+    return ok && !failed;
+}
+
+// ----------- Key/value state machine -----------
+// Reference state machine for replay. Records are
+//   [u8 op][u32 klen][key][value]   op: 'P' put, 'D' delete, 'C' clear
+// 'C' has no key and clears every shard (a replay barrier). Shards are
+// indexed like parallel_replay workers, so each is touched by one thread.
+struct KvStateMachine {
+    vector<unordered_map<string, string>> shards;
+
+    explicit KvStateMachine(unsigned n = 1): shards(max(1u, n)) {}
+
+    static void encode(char op, const string& key, const string& value, vector<uint8_t>& out) {
+        out.resize(5 + key.size() + value.size());
+        out[0] = (uint8_t)op;
+        store_be32(out.data() + 1, (uint32_t)key.size());
+        memcpy(out.data() + 5, key.data(), key.size());
+        memcpy(out.data() + 5 + key.size(), value.data(), value.size());
+    }
+
+    static bool key_of(const uint8_t* p, uint32_t n, const uint8_t*& key, size_t& klen) {
+        if (n < 5 || p[0] == 'C') return false;
+        klen = min<size_t>(load_be32(p + 1), n - 5);
+        key = p + 5;
+        return true;
+    }
+
+    bool apply(unsigned shard, uint64_t, const uint8_t* p, uint32_t n) {
+        if (n < 1) return false;
+        if (p[0] == 'C') {
+            for (auto& s : shards) s.clear();
+            return true;
+        }
+        if (n < 5 || load_be32(p + 1) > n - 5) return false;
+        uint32_t klen = load_be32(p + 1);
+        auto& m = shards[shard == ALL_SHARDS ? 0 : shard % shards.size()];
+        string key(reinterpret_cast<const char*>(p + 5), klen);
+        if (p[0] == 'P') {
+            m[std::move(key)].assign(reinterpret_cast<const char*>(p + 5 + klen), n - 5 - klen);
+        } else if (p[0] == 'D') {
+            m.erase(key);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (const auto& s : shards) n += s.size();
+        return n;
+    }
+
+    // Independent of sharding and iteration order, for comparing replays.
+    uint64_t digest() const {
+        uint64_t d = 0;
+        for (const auto& s : shards) {
+            for (const auto& kv : s) {
+                d += mix64(hash64(reinterpret_cast<const uint8_t*>(kv.first.data()), kv.first.size()) ^
+                           hash64(reinterpret_cast<const uint8_t*>(kv.second.data()), kv.second.size(), 1));
+            }
+        }
+        return d;
+    }
+};
+
+// ----------- Writer -----------
+// `<log>.durable` holds, as a u64, the end of the data the writer's last
+// sync() made durable, so another process (the shipper) can stay behind it.
+// It is rewritten in place without a sync: after a crash it may lag, never
+// lead, the durable end.
+static string durable_path(const string& path) { return path + ".durable"; }
+
+static bool load_durable_offset(const string& path, uint64_t& off) {
+    ifstream f(durable_path(path), ios::binary);
+    uint8_t b[8];
+    if (!f || !read_exact(f, b, 8)) return false;
+    off = load_be64(b);
+    return true;
+}
+
+struct WalWriter {
+    string path;
+    LogFormat format;
+    uint64_t size = 0;              // end of the last frame written
+    uint64_t chain = 0;             // running hash of all frames so far (chained logs)
+    uint64_t last_frame_offset = 0;
+    uint64_t records = 0;
+    uint64_t next_seq = 0;          // LSN of the next record (FMT_SEQ: its sequence number)
+    uint64_t first_lsn = 0;         // LSN of the oldest live record
+    bool prefix_pending = false;    // tail-only open: records/LSNs before the tail not counted yet
+    uint64_t start_offset = 0;      // logical start (oldest live frame)
+    uint64_t ring_end = 0;          // circular logs: end of the ring (file size)
+    Env* env = &posix_env();
+    unique_ptr<EnvFile> file;
+    int fd = -1;                    // POSIX descriptor of `file` (page-cache hints, hole punching), else -1
+    bool dir_pending = false;       // created by this writer: the next sync also syncs the directory
+    vector<uint8_t> frame;
+    unique_ptr<MerkleSidecar> merkle; // optional block-hash sidecar
+    unique_ptr<TimeIndexSidecar> tindex; // FMT_TIME logs: time -> offset index
+    uint64_t last_ts = 0;           // FMT_TIME: timestamp of the newest record
+    int durable_fd = -1;            // `<log>.durable`, opened on the first sync (POSIX only)
+
+    // Page-cache hygiene: when set, written data is pushed to disk in windows
+    // with sync_file_range and dropped from the cache once written back, so
+    // the log does not evict the rest of the process's working set.
+    bool drop_cache = false;
+    uint64_t writeback_issued = 0; // async writeback started up to here
+    uint64_t dropped_to = 0;       // cache dropped up to here
+    uint64_t dropped_bytes = 0;
+
+    // A new (or empty) log is created with `flags`; an existing log keeps its
+    // own format and is recovered first: a torn tail is cut durably, and for
+    // chained logs the chain state comes from the scan (cheap when a
+    // checkpoint exists).
+    WalWriter(string p, uint32_t flags = 0, Env& e = posix_env()): path(std::move(p)), env(&e) {
+        uint64_t existing = 0;
+        bool exists = env->file_size(path, existing);
+        ScanResult R;
+        if (existing > 0) {
+            // appending after a torn tail would leave the new records unreachable
+            R = scan_and_maybe_truncate(path, /*perform_truncate=*/true, nullptr, nullptr, false, *env);
+            // could not cut the tail: stay closed (rings overwrite in place instead)
+            if (!R.clean && !R.truncated && !(R.format.flags & FMT_CIRCULAR)) return;
+            if (R.truncated) existing = R.last_good_offset;
+        }
+        if (existing == 0) { // new, or nothing survived recovery
+            if (env->is_posix()) ::unlink(durable_path(path).c_str()); // from an older log
+            format.flags = flags;
+            file = env->open(path, OpenMode::Append);
+            dir_pending = !exists;
+            if (file && format.headered()) {
+                uint8_t hdr[LOG_HEADER_BYTES];
+                store_be32(hdr, LOG_MAGIC);
+                store_be32(hdr + 4, format.flags);
+                if (!file->append(hdr, sizeof hdr)) file.reset();
+            }
+            fd = file ? file->fd() : -1;
+            size = start_offset = format.data_start();
+            open_time_index();
+            return;
+        }
+        init(R, existing);
+    }
+    // Opens an existing log from a scan the caller already made (and whose
+    // truncation it already did), e.g. scan_tail().
+    WalWriter(string p, const ScanResult& R, Env& e = posix_env()): path(std::move(p)), env(&e) {
+        uint64_t existing = 0;
+        env->file_size(path, existing);
+        init(R, existing);
+    }
+    void init(const ScanResult& R, uint64_t existing) {
+        first_lsn = R.first_seq;
+        start_offset = R.head_offset;
+        format = R.format;
+        size = existing;
+        chain = R.chain;
+        last_frame_offset = R.last_frame_offset;
+        records = R.good_records;
+        next_seq = R.next_seq;
+        prefix_pending = R.tail_only;
+        if (format.flags & FMT_CIRCULAR) {
+            // overwrite in place from the recovered tail
+            ring_end = existing;
+            size = R.last_good_offset;
+        }
+        file = env->open(path, (format.flags & FMT_CIRCULAR) ? OpenMode::Update : OpenMode::Append);
+        fd = file ? file->fd() : -1;
+        uint8_t t[8];
+        if (file && (format.flags & FMT_TIME) && R.good_records > 0 &&
+            file->read_at(last_frame_offset + 4 + format.time_offset(), t, 8)) {
+            last_ts = load_be64(t); // timestamps keep increasing across restarts
+        }
+        open_time_index();
+    }
+    // FMT_TIME logs keep `<log>.tidx` in step with the appends (rings reuse
+    // offsets, so they have none). The index is advisory: failing to open it
+    // does not stop the writer.
+    bool open_time_index(uint64_t shift = 0) {
+        if (!(format.flags & FMT_TIME) || (format.flags & FMT_CIRCULAR) || !env->is_posix()) return true;
+        tindex.reset(new TimeIndexSidecar);
+        if (tindex->open(path, start_offset, size, shift)) return true;
+        tindex.reset();
+        return false;
+    }
+    // After a tail-only open: the background verification counted
+    // `prefix_records` intact records before the verified tail.
+    void prefix_verified(uint64_t prefix_records) {
+        if (!prefix_pending) return;
+        records += prefix_records;
+        if (!(format.flags & FMT_SEQ)) next_seq += prefix_records;
+        prefix_pending = false;
+    }
+    bool is_open() const { return file != nullptr; }
+    ~WalWriter() {
+        if (durable_fd >= 0) ::close(durable_fd);
+    }
+    WalWriter(const WalWriter&) = delete;
+    WalWriter& operator=(const WalWriter&) = delete;
+
+    bool append_record(const vector<uint8_t>& payload) {
+        return append_record(payload.data(), (uint32_t)payload.size());
+    }
+
+    bool append_record(const uint8_t* payload, uint32_t len) {
+        return append_record_seq(payload, len, next_seq);
+    }
+
+    // One write() per record: data reaches the page cache, not the disk (see
+    // sync()). With FMT_SEQ the record is stamped with `seq`, which must not
+    // go backwards; numbering continues from it. A circular log takes only
+    // the next number (or any, while empty). With FMT_TIME it carries
+    // `ts` (0 = now), raised to the previous record's if the clock stepped back.
+    bool append_record_seq(const uint8_t* payload, uint32_t len, uint64_t seq, uint64_t ts = 0) {
+        if (!file) return false;
+        if ((format.flags & FMT_SEQ) && seq < next_seq) return false;
+        // ring recovery follows strictly consecutive numbers to find the tail,
+        // so a gap there would silently cut the ring
+        if ((format.flags & FMT_CIRCULAR) && records > 0 && seq != next_seq) return false;
+        next_seq = seq;
+        if (format.flags & FMT_TIME) last_ts = max(ts ? ts : wall_clock_us(), last_ts);
+        frame.clear();
+        uint32_t c = encode_frame(format, chain, next_seq, last_ts, payload, len, frame);
+        if (format.flags & FMT_CIRCULAR) {
+            if (!ring_write()) return false;
+            next_seq++;
+            records++;
+            return true;
+        }
+        if (!file->append(frame.data(), frame.size())) return false;
+        if (merkle && !merkle->feed(frame.data(), frame.size())) return false;
+        if (tindex) tindex->note(last_ts, size, next_seq);
+        if (format.flags & FMT_CHAINED) chain = chain_next(chain, c, len);
+        last_frame_offset = size;
+        size += frame.size();
+        records++;
+        next_seq++;
+        if (drop_cache) writeback_behind();
+        return true;
+    }
+
+    // Circular logs: pwrite the encoded frame at the tail, wrapping to the
+    // ring start (after leaving a wrap marker) when it does not fit. The file
+    // never grows, so fdatasync has no size update to flush.
+    bool ring_write() {
+        uint64_t start = format.data_start();
+        if (frame.size() > ring_end - start) return false;
+        if (size + frame.size() > ring_end) {
+            if (size + 4 <= ring_end) {
+                uint8_t m[4];
+                store_be32(m, WRAP_MARKER);
+                if (!file->write_at(size, m, 4)) return false;
+            }
+            size = start;
+        }
+        if (!file->write_at(size, frame.data(), frame.size())) return false;
+        last_frame_offset = size;
+        size += frame.size();
+        return true;
+    }
+
+    // Every WRITEBACK_WINDOW bytes: start async writeback of the new window,
+    // then wait for the previous one and drop it. Not a durability point.
+    void writeback_behind() {
+        const uint64_t WRITEBACK_WINDOW = 1 << 20;
+        if (fd < 0) return;
+        if (writeback_issued < dropped_to) writeback_issued = dropped_to;
+        if (size - writeback_issued < WRITEBACK_WINDOW) return;
+#if defined(__linux__)
+        ::sync_file_range(fd, (off_t)writeback_issued, (off_t)(size - writeback_issued), SYNC_FILE_RANGE_WRITE);
+        if (writeback_issued > dropped_to) {
+            ::sync_file_range(fd, (off_t)dropped_to, (off_t)(writeback_issued - dropped_to),
+                              SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            dropped_bytes += drop_cached(fd, dropped_to, writeback_issued);
+            dropped_to = writeback_issued & ~uint64_t(4095);
+        }
+#endif
+        writeback_issued = size;
+    }
+
+    // Releases the storage of every record with LSN < `lsn`. The new logical
+    // start is made durable first, then the range is hole-punched (or, with
+    // `collapse`, removed so the file shrinks; offsets after it shift down).
+    // Only frame headers between the old and new start are read.
+    bool trim_head(uint64_t lsn, bool collapse, uint64_t& released) {
+        released = 0;
+        if (!file || (format.flags & FMT_CIRCULAR) || prefix_pending) return false;
+        if (lsn <= first_lsn) return true;
+        if (!sync()) return false;
+        uint64_t off = start_offset, cur = first_lsn, dropped = 0;
+        uint8_t h[4 + MAX_EXT_BYTES];
+        while (off < size) {
+            if (!file->read_at(off, h, 4 + format.ext_bytes())) break;
+            if (format.flags & FMT_SEQ) cur = load_be64(h + 4 + format.seq_offset());
+            if (cur >= lsn) break;
+            off += format.frame_size(load_be32(h));
+            dropped++;
+            if (!(format.flags & FMT_SEQ)) cur++;
+        }
+        if (off >= size) cur = next_seq;
+        LogStart S;
+        S.offset = off;
+        S.lsn = cur;
+        // storage is only released on POSIX files; other envs trim logically
+        int rw = env->is_posix() ? ::open(path.c_str(), O_RDWR) : -1;
+        if (env->is_posix() && rw < 0) return false;
+        struct stat st;
+        uint64_t blk = ::fstat(rw, &st) == 0 && st.st_blksize > 0 ? (uint64_t)st.st_blksize : 4096;
+        // the block holding the header is kept
+        uint32_t merkle_bs = merkle ? merkle->block_size : 0;
+        vector<uint64_t> unused;
+        if (!merkle) load_merkle_leaves(merkle_path(path), merkle_bs, unused);
+        bool has_merkle = merkle_bs != 0;
+        // a Merkle leaf must be released whole, or it would no longer verify
+        if (has_merkle && !collapse) blk = max<uint64_t>(blk, merkle_bs);
+        uint64_t from = (format.data_start() + blk - 1) / blk * blk, to = off / blk * blk;
+        bool ok = true;
+        if (to > from && rw >= 0) {
+#if defined(__linux__)
+            // the released range is punched first even when collapsing: a crash
+            // before the collapse then leaves no frame at offset - pending
+            S.pending_collapse = collapse ? to - from : 0;
+            ok = store_log_start(path, S) &&
+                 ::fallocate(rw, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)from, (off_t)(to - from)) == 0;
+            if (ok && collapse) {
+                // not every filesystem collapses; the punched range stays then
+                if (::fallocate(rw, FALLOC_FL_COLLAPSE_RANGE, (off_t)from, (off_t)(to - from)) == 0) {
+                    S.offset -= to - from;
+                    size -= to - from;
+                    last_frame_offset -= to - from;
+                    writeback_issued = dropped_to = 0;
+                    if (has_merkle) {
+                        // every block after the range moved: rebuild the sidecar
+                        merkle.reset();
+                        ::unlink(merkle_path(path).c_str());
+                        ok = enable_merkle(merkle_bs) && merkle->sync();
+                    }
+                    if (tindex) open_time_index(to - from);
+                    publish_durable(); // the data moved down, still durable
+                    ::unlink(scrub_progress_path(path).c_str()); // offsets moved: verify afresh
+                }
+                S.pending_collapse = 0;
+                ok = ok && store_log_start(path, S);
+            }
+            if (ok) released = to - from;
+#else
+            (void)collapse;
+            ok = store_log_start(path, S); // logical trim only
+#endif
+        } else {
+            ok = store_log_start(path, S, *env);
+        }
+        if (rw >= 0) ::close(rw);
+        if (!ok) return false;
+        start_offset = S.offset;
+        first_lsn = cur;
+        records -= dropped;
+        return !(format.flags & FMT_CHAINED) || checkpoint();
+    }
+
+    // Durably stores `state`, which must cover every record with LSN < `lsn`,
+    // then (with `trim`) releases the log before it and older snapshots.
+    bool snapshot(uint64_t lsn, const uint8_t* state, size_t n, bool trim = true) {
+        if (!file || !env->is_posix() || (format.flags & FMT_CIRCULAR) || lsn > next_seq) return false;
+        if (!sync() || !store_snapshot(path, lsn, state, n)) return false;
+        remove_snapshots_before(path, lsn);
+        uint64_t released = 0;
+        return !trim || trim_head(lsn, false, released);
+    }
+
+    // Starts maintaining `<log>.merkle`, catching up on existing data first.
+    bool enable_merkle(uint32_t block_size = MERKLE_BLOCK) {
+        // ring blocks are rewritten in place; the sidecar is POSIX-only
+        if ((format.flags & FMT_CIRCULAR) || !env->is_posix()) return false;
+        merkle.reset(new MerkleSidecar);
+        if (merkle->open(path, size, block_size)) return true;
+        merkle.reset();
+        return false;
+    }
+
+    // Makes all appended records durable. A log this writer created is not
+    // durable before its directory entry is, so the first sync covers that.
+    bool sync() {
+        if (!file || !file->sync()) return false;
+        if (dir_pending) {
+            if (!env->sync_dir(parent_dir(path))) return false;
+            dir_pending = false;
+        }
+        if (drop_cache && fd >= 0 && !(format.flags & FMT_CIRCULAR)) {
+            // everything is clean now: drop all but the partial last page
+            dropped_bytes += drop_cached(fd, dropped_to, size);
+            dropped_to = size & ~uint64_t(4095);
+            writeback_issued = size;
+        }
+        if (tindex) tindex->flush();
+        publish_durable();
+        return !merkle || merkle->sync();
+    }
+
+    // Records `size` as durable in `<log>.durable`; advisory, so failures
+    // are ignored. Rings overwrite in place and are not shipped.
+    void publish_durable() {
+        if (!env->is_posix() || (format.flags & FMT_CIRCULAR)) return;
+        if (durable_fd < 0) durable_fd = ::open(durable_path(path).c_str(), O_WRONLY | O_CREAT, 0644);
+        uint8_t b[8];
+        store_be64(b, size);
+        if (durable_fd >= 0 && ::pwrite(durable_fd, b, sizeof b, 0) != (ssize_t)sizeof b) {
+            ::close(durable_fd);
+            durable_fd = -1;
+        }
+    }
+
+    // Makes everything written so far durable and, for chained logs, records
+    // a checkpoint so recovery only has to verify frames written after it.
+    bool checkpoint() {
+        if (!(format.flags & FMT_CHAINED) || prefix_pending) return false;
+        if (!sync()) return false;
+        if (records == 0 && start_offset != format.data_start()) {
+            env->remove(checkpoint_path(path)); // nothing live left to certify
+            return true;
+        }
+        Checkpoint C;
+        C.offset = size;
+        C.chain = chain;
+        C.last_frame = last_frame_offset;
+        C.records = records;
+        return store_checkpoint(path, C, *env);
+    }
+};
+
+// ----------- Group commit (adaptive) -----------
+// Producers call commit(), which returns once the record is durable. A single
+// flusher thread writes whatever has queued up and covers it with one
+// fdatasync. Records that arrive while a sync runs form the next batch for
+// free; beyond that the flusher may linger for more arrivals. Linger time and
+// batch limit follow the measured sync latency S and arrival rate L:
+//  - fewer than one arrival per sync (L*S < 1): no linger, commit at once;
+//  - otherwise linger up to target - 2S (a record can wait for the sync in
+//    flight, the linger and its own sync), capped at max_linger_ms, but stop
+//    early once no record has arrived for two mean inter-arrival gaps (with
+//    a fixed set of synchronous producers, waiting longer gains nothing);
+//  - batch limit: the arrivals expected in S + linger, at least 1.
+// L is measured over windows of at least 5 ms so bursts do not skew it.
+//
+// Each commit has a class. The policy above applies to Urgent records. Bulk
+// records queue separately and are committed in large batches (bulk_batch_bytes
+// or bulk_linger_ms after the oldest one) and only when no urgent record is
+// waiting. A bulk batch is written in chunks; an urgent arrival ends it after
+// the current chunk, so an urgent commit never waits for more than one chunk
+// of bulk data to be written and synced.
+enum class CommitClass { Urgent = 0, Bulk = 1 };
+
+// What commit()/submit() do when the limits on outstanding (queued or being
+// written) records are reached: wait for room, reject at once, or make room
+// by dropping queued bulk records (newest first). Shed never drops urgent
+// records: an urgent append that cannot make room waits, an over-limit bulk
+// append is rejected.
+enum class OverloadPolicy { Block, Fail, Shed };
+
+struct GroupCommitOptions {
+    double target_latency_ms = 2.0;
+    double max_linger_ms = 5.0;
+    size_t max_batch = 4096;
+    size_t bulk_batch_bytes = 8 << 20;
+    double bulk_linger_ms = 20.0;
+    size_t bulk_chunk_bytes = 1 << 20;
+    uint64_t max_outstanding_bytes = 0;   // 0 = unlimited
+    uint64_t max_outstanding_records = 0; // 0 = unlimited
+    OverloadPolicy overload = OverloadPolicy::Block;
+};
+
+// Per-class commit latency: enqueue-to-durable, with a log2 histogram of
+// microseconds for percentiles; and what admission control did to the class.
+struct CommitClassStats {
+    uint64_t records = 0;
+    uint64_t batches = 0; // syncs that carried records of this class
+    uint64_t bytes = 0;
+    double commit_ms_sum = 0;
+    double commit_ms_max = 0;
+    uint64_t hist[32] = {};
+    uint64_t throttled = 0; // appends that had to wait for room
+    double throttled_ms = 0;
+    uint64_t rejected = 0;  // refused (Fail, or bulk under Shed)
+    uint64_t shed = 0;      // queued, then dropped for an urgent append
+
+    void record(double ms) {
+        records++;
+        commit_ms_sum += ms;
+        commit_ms_max = max(commit_ms_max, ms);
+        uint64_t us = (uint64_t)(ms * 1000.0);
+        unsigned b = 0;
+        while (b < 31 && (2ull << b) <= us) ++b;
+        hist[b]++;
+    }
+    // Upper bound of the bucket holding quantile `q`, in ms.
+    double percentile_ms(double q) const {
+        uint64_t total = 0, seen = 0;
+        for (uint64_t h : hist) total += h;
+        for (unsigned b = 0; b < 32; ++b) {
+            seen += hist[b];
+            if (total && seen >= q * total) return min(commit_ms_max, (2ull << b) / 1000.0);
+        }
+        return 0;
+    }
+};
+
+struct GroupCommitStats {
+    uint64_t records = 0;
+    uint64_t batches = 0;
+    double sync_ms_ewma = 0;   // measured fdatasync latency
+    double arrivals_per_s = 0; // measured urgent arrival rate
+    double linger_ms = 0;      // current decision
+    size_t batch_limit = 1;    // current decision
+    uint64_t bulk_preempted = 0; // bulk batches cut short by urgent arrivals
+    uint64_t peak_outstanding_bytes = 0;
+    uint64_t peak_outstanding_records = 0;
+    CommitClassStats cls[2];   // indexed by CommitClass
+};
+
+struct GroupCommitter {
+    // A queued record and how to report its outcome: a waiting commit()'s
+    // state (0 pending, 1 durable, 2 failed) or a submit() callback.
+    struct Pending {
+        vector<uint8_t> data;
+        chrono::steady_clock::time_point t0;
+        int* state = nullptr;
+        function<void(bool)> done;
+    };
+    struct ClassQueue {
+        deque<Pending> q;
+        size_t bytes = 0;
+        chrono::steady_clock::time_point oldest; // arrival of q.front() (bulk)
+    };
+
+    WalWriter& w;
+    GroupCommitOptions opt;
+    mutex mu;
+    condition_variable flusher_cv, done_cv;
+    ClassQueue urgent, bulk;
+    uint64_t outstanding_bytes = 0, outstanding_records = 0;
+    uint64_t urgent_enqueued = 0;
+    chrono::steady_clock::time_point last_arrival;
+    bool stop = false, failed = false;
+    GroupCommitStats st;
+    thread flusher;
+
+    // `on_start` runs first on the flusher thread (e.g. to pin it).
+    GroupCommitter(WalWriter& writer, GroupCommitOptions o = GroupCommitOptions(), function<void()> on_start = nullptr)
+        : w(writer), opt(o) {
+        flusher = thread([this, on_start] {
+            if (on_start) on_start();
+            run();
+        });
+    }
+    ~GroupCommitter() { close(); }
+    GroupCommitter(const GroupCommitter&) = delete;
+    GroupCommitter& operator=(const GroupCommitter&) = delete;
+
+    // Refuses new appends, commits everything queued and stops the flusher.
+    void close() {
+        {
+            lock_guard<mutex> lk(mu);
+            stop = true;
+        }
+        flusher_cv.notify_all();
+        done_cv.notify_all();
+        if (flusher.joinable()) flusher.join();
+    }
+
+    // Blocks until the record is durable. False if admission control refused
+    // or shed it, or once any write or sync has failed (the log's state is
+    // then unknown and every later commit fails).
+    bool commit(const uint8_t* p, uint32_t n, CommitClass c = CommitClass::Urgent) {
+        int state = 0;
+        unique_lock<mutex> lk(mu);
+        if (!enqueue(lk, p, n, c, &state, nullptr)) return false;
+        done_cv.wait(lk, [&] { return state != 0; });
+        return state == 1;
+    }
+
+    // Queues the record and returns; `done(durable)` runs on the flusher
+    // thread once its fate is known. False (and no callback) if admission
+    // control refused it.
+    bool submit(const uint8_t* p, uint32_t n, CommitClass c, function<void(bool)> done) {
+        unique_lock<mutex> lk(mu);
+        return enqueue(lk, p, n, c, nullptr, std::move(done));
+    }
+
+    GroupCommitStats stats() {
+        lock_guard<mutex> lk(mu);
+        return st;
+    }
+
+    // True once a write or sync failed; false returns before that are refusals.
+    bool log_failed() {
+        lock_guard<mutex> lk(mu);
+        return failed;
+    }
+
+    bool over_limit(uint64_t n) const {
+        // a record larger than the byte limit is still let through on its own
+        return (opt.max_outstanding_bytes && outstanding_records > 0 &&
+                outstanding_bytes + n > opt.max_outstanding_bytes) ||
+               (opt.max_outstanding_records && outstanding_records + 1 > opt.max_outstanding_records);
+    }
+
+    bool enqueue(unique_lock<mutex>& lk, const uint8_t* p, uint32_t n, CommitClass c, int* state,
+                 function<void(bool)> done) {
+        auto t0 = chrono::steady_clock::now();
+        CommitClassStats& cs = st.cls[(int)c];
+        if (failed || stop) return false;
+        if (over_limit(n)) {
+            OverloadPolicy pol = opt.overload;
+            if (pol == OverloadPolicy::Shed && c == CommitClass::Urgent) {
+                vector<function<void()>> callbacks;
+                while (over_limit(n) && !bulk.q.empty()) {
+                    Pending& v = bulk.q.back();
+                    bulk.bytes -= v.data.size();
+                    release(v.data.size());
+                    finish(v, false, callbacks);
+                    st.cls[(int)CommitClass::Bulk].shed++;
+                    bulk.q.pop_back();
+                }
+                if (!callbacks.empty()) {
+                    lk.unlock();
+                    for (auto& cb : callbacks) cb();
+                    lk.lock();
+                }
+                done_cv.notify_all();
+                pol = OverloadPolicy::Block; // whatever is left in flight is urgent or being written
+            }
+            if (pol != OverloadPolicy::Block) {
+                cs.rejected++;
+                return false;
+            }
+            cs.throttled++;
+            done_cv.wait(lk, [&] { return !over_limit(n) || failed || stop; });
+            cs.throttled_ms += ms_since(t0);
+            if (failed || stop) return false;
+        }
+        ClassQueue& Q = c == CommitClass::Urgent ? urgent : bulk;
+        if (Q.q.empty()) Q.oldest = t0;
+        Q.q.push_back(Pending{vector<uint8_t>(p, p + n), t0, state, std::move(done)});
+        Q.bytes += n;
+        outstanding_bytes += n;
+        outstanding_records++;
+        st.peak_outstanding_bytes = max(st.peak_outstanding_bytes, outstanding_bytes);
+        st.peak_outstanding_records = max(st.peak_outstanding_records, outstanding_records);
+        if (c == CommitClass::Urgent) {
+            urgent_enqueued++;
+            last_arrival = t0;
+            if (Q.q.size() == 1 || Q.q.size() >= st.batch_limit) flusher_cv.notify_one();
+        } else if (Q.q.size() == 1 || Q.bytes >= opt.bulk_batch_bytes) {
+            flusher_cv.notify_one();
+        }
+        return true;
+    }
+
+    void release(uint64_t n) {
+        outstanding_bytes -= n;
+        outstanding_records--;
+    }
+
+    // Reports one outcome (mu held); callbacks are collected to run unlocked.
+    static void finish(Pending& v, bool ok, vector<function<void()>>& callbacks) {
+        if (v.state) *v.state = ok ? 1 : 2;
+        if (v.done) callbacks.push_back([cb = std::move(v.done), ok] { cb(ok); });
+    }
+
+    bool bulk_due(chrono::steady_clock::time_point now) const {
+        return !bulk.q.empty() &&
+               (stop || bulk.bytes >= opt.bulk_batch_bytes ||
+                now >= bulk.oldest + chrono::duration_cast<chrono::nanoseconds>(chrono::duration<double, milli>(opt.bulk_linger_ms)));
+    }
+
+    void run() {
+        vector<Pending> batch;
+        vector<function<void()>> callbacks;
+        bool last_urgent = false;
+        uint64_t window_start_count = 0;
+        auto window_start = chrono::steady_clock::now();
+        unique_lock<mutex> lk(mu);
+        for (;;) {
+            while (urgent.q.empty() && !bulk_due(chrono::steady_clock::now())) {
+                if (stop && bulk.q.empty()) break;
+                if (bulk.q.empty()) {
+                    flusher_cv.wait(lk);
+                } else {
+                    flusher_cv.wait_until(lk, bulk.oldest + chrono::duration_cast<chrono::nanoseconds>(
+                                                                 chrono::duration<double, milli>(opt.bulk_linger_ms)));
+                }
+            }
+            if (urgent.q.empty() && bulk.q.empty()) break; // stopping
+            // urgent first, but a due bulk batch gets every other turn so it
+            // cannot starve; urgent arrivals still cut it short after a chunk
+            bool is_urgent = !urgent.q.empty() && !(last_urgent && bulk_due(chrono::steady_clock::now()));
+            last_urgent = is_urgent;
+            ClassQueue& Q = is_urgent ? urgent : bulk;
+            if (is_urgent && st.linger_ms > 0) {
+                auto deadline = chrono::steady_clock::now() +
+                                chrono::duration_cast<chrono::nanoseconds>(chrono::duration<double, milli>(st.linger_ms));
+                auto idle_gap = chrono::duration_cast<chrono::nanoseconds>(chrono::duration<double>(2.0 / max(1.0, st.arrivals_per_s)));
+                while (!stop && urgent.q.size() < st.batch_limit) {
+                    auto until = min(deadline, last_arrival + idle_gap);
+                    if (chrono::steady_clock::now() >= until) break;
+                    flusher_cv.wait_until(lk, until);
+                }
+            }
+            // urgent: everything queued; bulk: up to one batch
+            size_t take_bytes = 0;
+            while (!Q.q.empty() && (is_urgent || batch.empty() || take_bytes + Q.q.front().data.size() <= opt.bulk_batch_bytes)) {
+                take_bytes += Q.q.front().data.size();
+                batch.push_back(std::move(Q.q.front()));
+                Q.q.pop_front();
+            }
+            Q.bytes -= take_bytes;
+            Q.oldest = chrono::steady_clock::now();
+            lk.unlock();
+
+            bool ok = true;
+            size_t written = 0, chunk = 0;
+            uint64_t written_bytes = 0;
+            for (; written < batch.size() && ok; ++written) {
+                ok = w.append_record(batch[written].data);
+                chunk += batch[written].data.size();
+                written_bytes += batch[written].data.size();
+                if (!is_urgent && chunk >= opt.bulk_chunk_bytes && written + 1 < batch.size()) {
+                    chunk = 0;
+                    lock_guard<mutex> g(mu);
+                    if (!urgent.q.empty()) { ++written; break; } // sync what is written, urgent goes next
+                }
+            }
+            auto t0 = chrono::steady_clock::now();
+            ok = ok && w.sync();
+            double sync_ms = ms_since(t0);
+
+            lk.lock();
+            if (written < batch.size()) {
+                // preempted: the unwritten rest goes back to the front, in order
+                st.bulk_preempted++;
+                for (size_t i = batch.size(); i-- > written;) {
+                    Q.bytes += batch[i].data.size();
+                    Q.q.push_front(std::move(batch[i]));
+                }
+                batch.resize(written);
+            }
+            if (!ok) failed = true;
+            CommitClassStats& cs = st.cls[is_urgent ? 0 : 1];
+            for (auto& v : batch) {
+                release(v.data.size());
+                if (ok) cs.record(ms_since(v.t0));
+                finish(v, ok, callbacks);
+            }
+            batch.clear();
+            if (failed) {
+                // nothing after a failed write or sync can be made durable
+                for (ClassQueue* q : {&urgent, &bulk}) {
+                    for (auto& v : q->q) {
+                        release(v.data.size());
+                        finish(v, false, callbacks);
+                    }
+                    q->q.clear();
+                    q->bytes = 0;
+                }
+            }
+            st.records += ok ? written : 0;
+            st.batches++;
+            cs.batches++;
+            cs.bytes += written_bytes;
+            double window_ms = ms_since(window_start);
+            if (window_ms >= 5.0) {
+                update_rate((urgent_enqueued - window_start_count) * 1000.0 / window_ms);
+                window_start_count = urgent_enqueued;
+                window_start = chrono::steady_clock::now();
+            }
+            adapt(sync_ms);
+            done_cv.notify_all();
+            if (!callbacks.empty()) {
+                lk.unlock();
+                for (auto& cb : callbacks) cb();
+                callbacks.clear();
+                lk.lock();
+            }
+            if (failed) break;
+        }
+        done_cv.notify_all();
+    }
+
+    void update_rate(double rate) {
+        const double A = 0.3;
+        st.arrivals_per_s = st.arrivals_per_s == 0 ? rate : (1 - A) * st.arrivals_per_s + A * rate;
+    }
+
+    void adapt(double sync_ms) {
+        const double A = 0.2;
+        st.sync_ms_ewma = st.batches == 1 ? sync_ms : (1 - A) * st.sync_ms_ewma + A * sync_ms;
+        double S = st.sync_ms_ewma, per_ms = st.arrivals_per_s / 1000.0;
+        st.linger_ms = per_ms * S < 1 ? 0 : max(0.0, min(opt.max_linger_ms, opt.target_latency_ms - 2 * S));
+        double expect = per_ms * (S + st.linger_ms);
+        st.batch_limit = (size_t)max(1.0, min((double)opt.max_batch, expect));
+    }
+};
+
+// ----------- Salvage (resync past corrupt records) -----------
+// Read-only mapping of a whole file; salvage jumps around while resyncing,
+// which is simpler and faster on a mapping than with seek+read.
+struct MappedFile {
+    const uint8_t* data = nullptr;
+    uint64_t size = 0;
+    int fd = -1;
+    bool open(const string& path) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0) return false;
+        size = (uint64_t)st.st_size;
+        if (size == 0) return true;
+        void* m = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) return false;
+        data = static_cast<const uint8_t*>(m);
+        ::madvise(m, size, MADV_SEQUENTIAL);
+        return true;
+    }
+    // Drops the whole pages of [from, to) from the page cache. Mapped pages
+    // are not evicted, so the range is unmapped from this process first
+    // (MADV_DONTNEED; later reads fault it back in). Returns the bytes that
+    // actually left the cache, as mincore() sees them.
+    uint64_t drop(uint64_t from, uint64_t to) {
+#if defined(__linux__)
+        static const uint64_t PAGE = (uint64_t)::sysconf(_SC_PAGESIZE);
+        uint64_t a = (from + PAGE - 1) / PAGE * PAGE, b = min(to, size) / PAGE * PAGE;
+        if (!data || b <= a) return 0;
+        uint8_t* p = const_cast<uint8_t*>(data) + a;
+        vector<unsigned char> pages((size_t)((b - a) / PAGE));
+        auto resident = [&]() -> uint64_t {
+            if (::mincore(p, b - a, pages.data()) != 0) return 0;
+            uint64_t n = 0;
+            for (unsigned char c : pages) n += c & 1;
+            return n * PAGE;
+        };
+        uint64_t before = resident();
+        ::madvise(p, b - a, MADV_DONTNEED);
+        drop_cached(fd, a, b);
+        uint64_t after = resident();
+        return before > after ? before - after : 0;
+#else
+        (void)from; (void)to;
+        return 0;
+#endif
+    }
+    ~MappedFile() {
+        if (data) ::munmap(const_cast<uint8_t*>(data), size);
+        if (fd >= 0) ::close(fd);
+    }
+};
+
+// Header checks only: length plausible and the whole frame fits in the file.
+static inline bool header_plausible(const LogFormat& F, const uint8_t* base, uint64_t sz, uint64_t off) {
+    if (off + 4 > sz) return false;
+    uint32_t len = load_be32(base + off);
+    return len != 0 && len <= MAX_REC && off + F.frame_size(len) <= sz;
+}
+
+// Full check of the frame at `off`; returns its total size or 0 if invalid.
+// Chain fields are not checked: they necessarily break across a skipped range.
+static inline uint64_t frame_valid_at(const LogFormat& F, const uint8_t* base, uint64_t sz, uint64_t off) {
+    if (!header_plausible(F, base, sz, off)) return 0;
+    uint32_t len = load_be32(base + off);
+    uint32_t body = F.ext_bytes() + len;
+    if (load_be32(base + off + 4 + body) != crc32(base + off + 4, body)) return 0;
+    return F.frame_size(len);
+}
+
+// First offset >= `from` whose leading byte could begin a big-endian length
+// <= MAX_REC. With the 32MB cap that byte is 0..2, which rejects ~99% of
+// positions in arbitrary data 16/32 bytes at a time.
+static uint64_t next_len_candidate(const uint8_t* base, uint64_t sz, uint64_t from) {
+    const uint8_t top = uint8_t(MAX_REC >> 24);
+    uint64_t end = sz >= 8 ? sz - 8 : 0; // shortest frame is len+1+crc
+    uint64_t i = from;
+#if defined(__AVX2__)
+    const __m256i bias32 = _mm256_set1_epi8((char)top);
+    const __m256i zero32 = _mm256_setzero_si256();
+    for (; i + 32 <= end; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + i));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_subs_epu8(x, bias32), zero32));
+        if (m) return i + __builtin_ctz(m);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i bias = _mm_set1_epi8((char)top);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= end; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + i));
+        uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(x, bias), zero));
+        if (m) return i + __builtin_ctz(m);
+    }
+#endif
+    for (; i < end; ++i) {
+        if (base[i] <= top) return i;
+    }
+    return sz;
+}
+
+struct SalvageResult {
+    size_t good_records = 0;
+    uint64_t good_bytes = 0;
+    vector<pair<uint64_t, uint64_t>> skipped; // [begin, end) ranges dropped
+    uint64_t crc_attempts = 0;                // resync candidates that reached a CRC
+};
+
+// Finds the next offset after a bad frame at `bad` where a valid frame starts.
+// A candidate must pass the SIMD byte filter and the header bounds check.
+// Candidates that end at EOF or are followed by another plausible header get
+// their CRC computed first. The rest (e.g. a good frame whose successor's
+// header is damaged) are CRC-checked afterwards, but only those ending
+// before the frame found that way: a real frame cannot overlap the next one.
+static uint64_t resync(const LogFormat& F, const uint8_t* base, uint64_t sz, uint64_t bad, SalvageResult& S) {
+    uint64_t o = bad + 1, found = sz;
+    vector<uint64_t> deferred; // plausible headers without a plausible successor
+    while (o < sz) {
+        o = next_len_candidate(base, sz, o);
+        if (o >= sz) break;
+        if (base[o] == 0 && o + 4 <= sz && load_be32(base + o) == 0) {
+            // zero run (padding or a zeroed block): every byte would pass the
+            // filter, so jump to its end; a length may start up to 3 bytes before it
+            uint64_t z = first_nonzero(base, o, sz);
+            o = z >= o + 3 ? z - 3 : o + 1;
+            if (z == sz) break;
+            continue;
+        }
+        if (header_plausible(F, base, sz, o)) {
+            uint64_t next = o + F.frame_size(load_be32(base + o));
+            if (next == sz || header_plausible(F, base, sz, next)) {
+                S.crc_attempts++;
+                if (frame_valid_at(F, base, sz, o)) {
+                    found = o;
+                    break;
+                }
+            } else {
+                deferred.push_back(o);
+            }
+        }
+        ++o;
+    }
+    for (uint64_t d : deferred) {
+        if (d + F.frame_size(load_be32(base + d)) > found) continue;
+        S.crc_attempts++;
+        if (frame_valid_at(F, base, sz, d)) return d;
+    }
+    return found;
+}
+
+// Copies every valid frame of `path` into `out_path`, skipping corrupt
+// stretches instead of stopping at the first one. The source is not modified.
+// Frames of plain logs are copied verbatim; chained logs are re-framed so the
+// cleaned copy carries an unbroken chain.
+static bool salvage_log(const string& path, const string& out_path, SalvageResult& S) {
+    MappedFile m;
+    if (!m.open(path)) {
+        cerr << "[salvage] cannot open/map " << path << "\n";
+        return false;
+    }
+    ofstream out(out_path, ios::binary | ios::trunc);
+    if (!out) {
+        cerr << "[salvage] cannot create " << out_path << "\n";
+        return false;
+    }
+    const uint8_t* base = m.data;
+    uint64_t sz = m.size;
+    LogFormat F;
+    if (parse_log_header(base, sz, F) != HeaderStatus::Ok) {
+        cerr << "[salvage] unsupported or torn log header\n";
+        return false;
+    }
+    if (F.flags & FMT_CIRCULAR) {
+        cerr << "[salvage] circular logs are not supported (recover resumes them in place)\n";
+        return false;
+    }
+    vector<uint8_t> frame;
+    uint64_t chain = 0;
+    if (F.headered()) {
+        if (!write_all(out, base, LOG_HEADER_BYTES)) return false;
+    }
+    uint64_t off = F.data_start();
+    LogStart LS;
+    if (load_log_start(path, LS) && LS.offset > off && LS.offset <= sz) off = LS.offset; // released by trim
+    while (off < sz) {
+        uint64_t n = frame_valid_at(F, base, sz, off);
+        if (n == 0) {
+            uint64_t next = resync(F, base, sz, off, S);
+            S.skipped.emplace_back(off, next);
+            off = next;
+            continue;
+        }
+        if (F.flags & FMT_CHAINED) {
+            uint32_t len = load_be32(base + off);
+            uint64_t seq = (F.flags & FMT_SEQ) ? load_be64(base + off + 4 + F.seq_offset()) : 0;
+            uint64_t ts = (F.flags & FMT_TIME) ? load_be64(base + off + 4 + F.time_offset()) : 0;
+            frame.clear();
+            uint32_t c = encode_frame(F, chain, seq, ts, base + off + 4 + F.ext_bytes(), len, frame);
+            chain = chain_next(chain, c, len);
+            if (!write_all(out, frame.data(), frame.size())) return false;
+        } else if (!write_all(out, base + off, n)) {
+            return false;
+        }
+        S.good_records++;
+        S.good_bytes += n;
+        off += n;
+    }
+    out.close();
+    if (!out) return false;
+    SyncBatch batch;
+    batch.add(out_path);
+    return batch.flush();
+}
+
+// ----------- Scrubber (background re-verification of sealed data) -----------
+// Re-checks frame CRCs of the sealed part of a log: up to the checkpoint for
+// chained logs, otherwise up to the last valid frame present when the pass
+// starts (a torn or zero-padded tail after it is recovery's business).
+// Progress is kept in `<log>.scrub` so a restarted scrubber resumes where it
+// stopped; corrupt stretches are skipped with the salvage resync and reported.
+struct ScrubOptions {
+    double rate_bytes = 0;     // bytes/sec, 0 = unlimited
+    bool idle_io = true;       // ioprio idle class for the scrub thread
+    IoLimiter* limiter = nullptr; // also pace against in-process recovery scans
+    bool drop_cache = true;    // drop verified pages from the page cache
+    uint64_t end = 0;          // stop here instead of the sealed end (a frame boundary)
+    bool resume = true;        // load and save progress in `<log>.scrub`
+    function<void(uint64_t, uint64_t)> on_bad; // [begin, end) of a bad range
+};
+
+struct ScrubResult {
+    uint64_t resumed_from = 0;
+    uint64_t sealed_end = 0;
+    uint64_t bytes = 0;
+    uint64_t frames = 0;
+    vector<pair<uint64_t, uint64_t>> bad;
+    bool completed = false; // reached sealed_end (progress reset for the next pass)
+    uint64_t dropped_bytes = 0;
+};
+
+static string scrub_progress_path(const string& path) { return path + ".scrub"; }
+
+static bool load_scrub_progress(const string& path, uint64_t& next) {
+    ifstream f(scrub_progress_path(path), ios::binary);
+    uint8_t b[12];
+    if (!f || !read_exact(f, b, sizeof b) || load_be32(b + 8) != crc32(b, 8)) return false;
+    next = load_be64(b);
+    return true;
+}
+
+// tmp + rename so a crash leaves either the old or the new offset; not
+// fsynced, since losing progress only costs re-verification.
+static bool store_scrub_progress(const string& path, uint64_t next) {
+    uint8_t b[12];
+    store_be64(b, next);
+    store_be32(b + 8, crc32(b, 8));
+    string tmp = scrub_progress_path(path) + ".tmp";
+    {
+        ofstream f(tmp, ios::binary | ios::trunc);
+        if (!f || !write_all(f, b, sizeof b)) return false;
+    }
+    return ::rename(tmp.c_str(), scrub_progress_path(path).c_str()) == 0;
+}
+
+// One pass from the saved progress to the sealed end (or until `stop`).
+static bool scrub_pass(const string& path, const ScrubOptions& opt, const atomic<bool>* stop, ScrubResult& R) {
+    MappedFile m;
+    if (!m.open(path)) {
+        cerr << "[scrub] cannot open/map " << path << "\n";
+        return false;
+    }
+    LogFormat F;
+    if (parse_log_header(m.data, m.size, F) != HeaderStatus::Ok) {
+        cerr << "[scrub] unsupported or torn log header\n";
+        return false;
+    }
+    if (F.flags & FMT_CIRCULAR) {
+        cerr << "[scrub] circular logs are not supported\n";
+        return false;
+    }
+    uint64_t sealed = m.size;
+    bool fixed_end = false; // else the pass ends after the last valid frame
+    Checkpoint C;
+    if ((F.flags & FMT_CHAINED) && load_checkpoint(path, C) && C.offset <= m.size) {
+        sealed = C.offset;
+        fixed_end = true;
+    }
+    if (opt.end) {
+        sealed = min(sealed, opt.end);
+        fixed_end = true;
+    }
+
+    uint64_t off = F.data_start();
+    LogStart LS;
+    if (load_log_start(path, LS) && LS.offset > off && LS.offset <= sealed) off = LS.offset; // released by trim
+    uint64_t saved = 0;
+    // saved progress is only trusted on a frame boundary (the log may have
+    // been cut and regrown since)
+    if (opt.resume && load_scrub_progress(path, saved) && saved >= off && saved <= sealed &&
+        (saved == sealed || frame_valid_at(F, m.data, sealed, saved))) {
+        off = saved;
+    }
+    R.resumed_from = off;
+
+    TokenBucket bucket(opt.rate_bytes);
+    const uint64_t CHUNK = 1 << 20, SAVE_EVERY = 64ull << 20;
+    uint64_t pending = 0, since_save = 0, dropped_to = off;
+    auto last_save = chrono::steady_clock::now();
+    SalvageResult unused;
+    while (off < sealed) {
+        if (stop && stop->load()) break;
+        uint64_t n = frame_valid_at(F, m.data, sealed, off);
+        if (n == 0) {
+            if (!header_plausible(F, m.data, m.size, off) ||
+                off + F.frame_size(load_be32(m.data + off)) <= sealed) {
+                uint64_t next = resync(F, m.data, sealed, off, unused);
+                if (next >= sealed && !fixed_end) {
+                    sealed = off; // nothing valid follows: the unsealed tail
+                    break;
+                }
+                R.bad.emplace_back(off, next);
+                if (opt.on_bad) opt.on_bad(off, next);
+                n = next - off;
+            } else if (opt.end && sealed == opt.end) {
+                // a frame must end exactly at an explicit end
+                R.bad.emplace_back(off, sealed);
+                if (opt.on_bad) opt.on_bad(off, sealed);
+                n = sealed - off;
+            } else {
+                sealed = off; // frame runs into the unsealed tail
+                break;
+            }
+        } else {
+            R.frames++;
+        }
+        off += n;
+        R.bytes += n;
+        pending += n;
+        since_save += n;
+        if (pending >= CHUNK) {
+            bucket.acquire(pending);
+            if (opt.limiter) opt.limiter->acquire(pending, IoPriority::Background);
+            pending = 0;
+            if (opt.drop_cache) {
+                R.dropped_bytes += m.drop(dropped_to, off);
+                dropped_to = off & ~uint64_t(4095);
+            }
+            // persist every 64MB or every second, whichever comes first
+            if (opt.resume && (since_save >= SAVE_EVERY || ms_since(last_save) >= 1000)) {
+                store_scrub_progress(path, off);
+                since_save = 0;
+                last_save = chrono::steady_clock::now();
+            }
+        }
+    }
+    if (opt.drop_cache) R.dropped_bytes += m.drop(dropped_to, off);
+    R.sealed_end = sealed;
+    R.completed = off >= sealed || !(stop && stop->load());
+    if (!opt.resume) return true;
+    // a finished pass starts over next time
+    return store_scrub_progress(path, R.completed ? F.data_start() : off);
+}
+
+// Runs scrub passes on its own thread, `interval` apart, until stopped or
+// `passes` passes have completed (0 = forever).
+struct BackgroundScrubber {
+    atomic<bool> stop{false};
+    thread worker;
+
+    void start(const string& path, ScrubOptions opt, chrono::milliseconds interval, unsigned passes,
+               function<void(const ScrubResult&)> on_pass) {
+        worker = thread([this, path, opt, interval, passes, on_pass] {
+            if (opt.idle_io) set_idle_io_priority();
+            for (unsigned i = 0; (passes == 0 || i < passes) && !stop.load(); ++i) {
+                ScrubResult R;
+                if (!scrub_pass(path, opt, &stop, R)) break;
+                if (on_pass) on_pass(R);
+                auto until = chrono::steady_clock::now() + interval;
+                while ((passes == 0 || i + 1 < passes) && !stop.load() && chrono::steady_clock::now() < until) {
+                    this_thread::sleep_for(chrono::milliseconds(50));
+                }
+            }
+        });
+    }
+    void join() { if (worker.joinable()) worker.join(); }
+    ~BackgroundScrubber() { stop = true; join(); }
+};
+
+// ----------- Fast open (tail-only verification) -----------
+// A normal open verifies every frame before the first append. A fast open
+// verifies only the tail synchronously: the frames after the checkpoint for
+// chained logs, otherwise the frames from the first one found in the last
+// `window` bytes. The writer opens right away and the older part is verified
+// by a background scrub pass that ends where the tail began.
+//
+// The resync that finds the anchor could in principle land on a frame nested
+// inside a payload, so the fast path only cuts a torn tail (no valid frame
+// after the cut). Anything else, like stale frames from another history, falls
+// back to the full scan, which stays the authority on what gets discarded.
+static ScanResult scan_tail(const string& path, uint64_t window, SyncBatch* batch = nullptr) {
+    auto full = [&] { return scan_and_maybe_truncate(path, /*perform_truncate=*/true, batch); };
+    ScanResult R;
+    {
+        MappedFile m;
+        LogFormat F;
+        if (!m.open(path) || parse_log_header(m.data, m.size, F) != HeaderStatus::Ok) return full();
+        const uint8_t* base = m.data;
+        uint64_t sz = m.size, start = F.data_start();
+        Checkpoint C;
+        if ((F.flags & FMT_CIRCULAR) || ((F.flags & FMT_CHAINED) && load_checkpoint(path, C) && C.offset <= sz)) {
+            return full(); // circular logs have their own scan; a checkpoint already bounds it
+        }
+        LogStart LS;
+        if (load_log_start(path, LS)) {
+            if (LS.pending_collapse) return full();
+            if (LS.offset > start && LS.offset <= sz) start = LS.offset;
+            R.first_seq = LS.lsn;
+        }
+        if (sz - start <= window) return full();
+        SalvageResult unused;
+        uint64_t anchor = resync(F, base, sz, sz - window - 1, unused);
+        if (anchor >= sz) return full();
+
+        uint64_t off = anchor, chain = 0, next_seq = 0;
+        for (uint64_t n; (n = frame_valid_at(F, base, sz, off)) != 0; off += n) {
+            uint32_t len = load_be32(base + off);
+            const uint8_t* ext = base + off + 4;
+            if (F.flags & FMT_CHAINED) {
+                uint64_t c = load_be64(ext);
+                if (R.good_records > 0 && c != chain) break;
+                chain = chain_next(c, load_be32(ext + F.ext_bytes() + len), len);
+            }
+            if (F.flags & FMT_SEQ) {
+                uint64_t q = load_be64(ext + F.seq_offset());
+                if (R.good_records > 0 && q < next_seq) break;
+                next_seq = q + 1;
+            }
+            R.last_frame_offset = off;
+            R.good_records++;
+        }
+        if (off < sz) {
+            if (frame_valid_at(F, base, sz, off) || resync(F, base, sz, off, unused) < sz) return full();
+            R.clean = false;
+            if (off + 4 <= sz && load_be32(base + off) == 0) {
+                ZeroTail Z = check_zero_tail(path, off, sz);
+                R.padding_bytes = Z.padding_bytes;
+                R.hole_bytes = Z.hole_bytes;
+                R.padding_sampled = Z.sampled;
+            }
+        }
+        if ((F.flags & FMT_SEQ) && frame_valid_at(F, base, sz, start)) {
+            R.first_seq = load_be64(base + start + 4 + F.seq_offset());
+        }
+        R.format = F;
+        R.chain = chain;
+        R.last_good_offset = off;
+        R.head_offset = start;
+        R.verified_from = anchor;
+        R.tail_only = true;
+        // without sequence numbers the LSNs depend on the unverified prefix
+        R.next_seq = (F.flags & FMT_SEQ) ? next_seq : R.first_seq + R.good_records;
+    }
+    if (!R.clean) cut_torn_tail(path, R, batch);
+    return R;
+}
+
+// A writer opened from scan_tail() plus the background pass over the rest.
+// After `on_done` the caller should hand ScrubResult::frames to
+// WalWriter::prefix_verified() from the thread that appends.
+struct FastOpen {
+    ScanResult scan;
+    uint64_t verify_begin = 0, verify_end = 0; // range left to the background pass
+    unique_ptr<WalWriter> writer;
+    BackgroundScrubber verifier;
+};
+
+static bool open_for_append(const string& path, uint64_t window, FastOpen& out,
+                            function<void(uint64_t, uint64_t)> on_bad,
+                            function<void(const ScrubResult&)> on_done) {
+    out.scan = scan_tail(path, window);
+    const ScanResult& R = out.scan;
+    out.writer.reset(new WalWriter(path, R));
+    if (!out.writer->is_open()) {
+        cerr << "[open] cannot open " << path << " for append\n";
+        return false;
+    }
+    out.verify_begin = R.head_offset;
+    out.verify_end = (R.tail_only || R.used_checkpoint) ? R.verified_from : R.head_offset;
+    if (out.verify_end <= out.verify_begin) {
+        if (on_done) {
+            ScrubResult S;
+            S.resumed_from = S.sealed_end = out.verify_end;
+            S.completed = true;
+            on_done(S);
+        }
+        return true;
+    }
+    ScrubOptions opt;
+    opt.end = out.verify_end;
+    opt.resume = false;
+    opt.limiter = &recovery_io_limiter();
+    opt.on_bad = std::move(on_bad);
+    out.verifier.start(path, opt, chrono::milliseconds(0), 1, std::move(on_done));
+    return true;
+}
+
+// ----------- Block cache (random-access reads) -----------
+// Sharded LRU cache of fixed-size, aligned file blocks keyed by (segment,
+// block index); a segment is one open log file. Blocks are handed out as
+// shared pointers, so an eviction never frees bytes a reader still uses.
+// The block holding the end of a live log grows as records are appended: a
+// cached copy shorter than a read needs is re-read and counted as a miss.
+struct CacheKey {
+    uint64_t seg = 0, block = 0;
+    bool operator==(const CacheKey& o) const { return seg == o.seg && block == o.block; }
+};
+
+struct CacheKeyHash {
+    size_t operator()(const CacheKey& k) const { return hash<uint64_t>()(k.seg * 0x9E3779B97F4A7C15ull ^ k.block); }
+};
+
+struct BlockCacheStats {
+    uint64_t hits = 0, misses = 0, evictions = 0;
+    uint64_t bytes = 0, pinned_bytes = 0;
+    double hit_ratio() const { return hits + misses ? double(hits) / double(hits + misses) : 0; }
+};
+
+struct BlockCache {
+    using Block = shared_ptr<const vector<uint8_t>>;
+    struct Entry {
+        Block data;
+        list<CacheKey>::iterator pos; // in `lru`, front = most recently used
+        unsigned pins = 0;
+    };
+    struct Shard {
+        mutex mu;
+        list<CacheKey> lru;
+        unordered_map<CacheKey, Entry, CacheKeyHash> map;
+        BlockCacheStats st;
+    };
+    uint32_t block_size;
+    uint64_t shard_capacity;
+    vector<unique_ptr<Shard>> shards;
+    atomic<uint64_t> next_seg{1};
+
+    explicit BlockCache(uint64_t capacity, uint32_t bs = 64 * 1024, unsigned nshards = 16)
+        : block_size(bs), shard_capacity(max<uint64_t>(capacity / max(nshards, 1u), bs)) {
+        for (unsigned i = 0; i < max(nshards, 1u); ++i) shards.emplace_back(new Shard);
+    }
+
+    uint64_t new_segment() { return next_seg.fetch_add(1); }
+
+    Shard& shard_of(const CacheKey& k) { return *shards[CacheKeyHash()(k) % shards.size()]; }
+
+    // Block `block` of segment `seg` with at least `need` bytes (fewer only
+    // at end of file), read from `fd` on a miss. The read happens outside the
+    // shard lock; with `pin` the block stays cached until unpin().
+    Block get(uint64_t seg, int fd, uint64_t block, uint32_t need, bool pin = false) {
+        CacheKey k{seg, block};
+        Shard& sh = shard_of(k);
+        {
+            lock_guard<mutex> lk(sh.mu);
+            auto it = sh.map.find(k);
+            if (it != sh.map.end() && it->second.data->size() >= need) {
+                sh.st.hits++;
+                sh.lru.splice(sh.lru.begin(), sh.lru, it->second.pos);
+                if (pin && it->second.pins++ == 0) sh.st.pinned_bytes += it->second.data->size();
+                return it->second.data;
+            }
+            sh.st.misses++;
+        }
+        auto buf = make_shared<vector<uint8_t>>(block_size);
+        size_t got = 0;
+        while (got < block_size) {
+            ssize_t r = ::pread(fd, buf->data() + got, block_size - got, (off_t)(block * block_size + got));
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;
+            got += (size_t)r;
+        }
+        buf->resize(got);
+        Block b = buf;
+        lock_guard<mutex> lk(sh.mu);
+        auto it = sh.map.find(k);
+        if (it == sh.map.end()) {
+            sh.lru.push_front(k);
+            it = sh.map.emplace(k, Entry{b, sh.lru.begin(), 0}).first;
+            sh.st.bytes += b->size();
+        } else {
+            sh.lru.splice(sh.lru.begin(), sh.lru, it->second.pos);
+            if (b->size() > it->second.data->size()) {
+                sh.st.bytes += b->size() - it->second.data->size();
+                if (it->second.pins) sh.st.pinned_bytes += b->size() - it->second.data->size();
+                it->second.data = b;
+            } else {
+                b = it->second.data; // a concurrent read got at least as far
+            }
+        }
+        if (pin && it->second.pins++ == 0) sh.st.pinned_bytes += b->size();
+        evict(sh);
+        return b;
+    }
+
+    void unpin(uint64_t seg, uint64_t block) {
+        CacheKey k{seg, block};
+        Shard& sh = shard_of(k);
+        lock_guard<mutex> lk(sh.mu);
+        auto it = sh.map.find(k);
+        if (it == sh.map.end() || it->second.pins == 0) return;
+        if (--it->second.pins == 0) sh.st.pinned_bytes -= it->second.data->size();
+        evict(sh);
+    }
+
+    // Drops every block of `seg` (the file was closed, truncated or trimmed).
+    void erase_segment(uint64_t seg) {
+        for (auto& s : shards) {
+            lock_guard<mutex> lk(s->mu);
+            for (auto it = s->map.begin(); it != s->map.end();) {
+                if (it->first.seg != seg) { ++it; continue; }
+                s->st.bytes -= it->second.data->size();
+                if (it->second.pins) s->st.pinned_bytes -= it->second.data->size();
+                s->lru.erase(it->second.pos);
+                it = s->map.erase(it);
+            }
+        }
+    }
+
+    // Least recently used unpinned blocks go first; pinned ones are skipped.
+    void evict(Shard& sh) {
+        auto it = sh.lru.end();
+        while (sh.st.bytes > shard_capacity && it != sh.lru.begin()) {
+            --it;
+            auto e = sh.map.find(*it);
+            if (e->second.pins) continue;
+            sh.st.bytes -= e->second.data->size();
+            sh.st.evictions++;
+            sh.map.erase(e);
+            it = sh.lru.erase(it);
+        }
+    }
+
+    BlockCacheStats stats() {
+        BlockCacheStats t;
+        for (auto& s : shards) {
+            lock_guard<mutex> lk(s->mu);
+            t.hits += s->st.hits;
+            t.misses += s->st.misses;
+            t.evictions += s->st.evictions;
+            t.bytes += s->st.bytes;
+            t.pinned_bytes += s->st.pinned_bytes;
+        }
+        return t;
+    }
+};
+
+// Reads single records by offset or LSN with pread, through an optional
+// BlockCache. A sparse (LSN, offset) index with one entry per INDEX_EVERY
+// frames is built when the reader opens; a lookup walks frame headers from
+// the nearest entry. The block holding the log's end is kept pinned since
+// lookback reads mostly land there. Safe for concurrent lookups; refresh()
+// must not run concurrently with them.
+struct RecordReader {
+    static const uint64_t INDEX_EVERY = 16;
+    string path;
+    LogFormat F;
+    int fd = -1;
+    BlockCache* cache = nullptr;
+    uint64_t seg = 0;
+    uint64_t start = 0, end = 0;       // live frames are in [start, end)
+    uint64_t first_lsn = 0, next_lsn = 0;
+    uint64_t last_lsn_indexed = 0, frames = 0;
+    vector<pair<uint64_t, uint64_t>> index; // (lsn, offset)
+    uint64_t tail_block = UINT64_MAX;
+    atomic<uint64_t> preads{0};
+
+    bool open(const string& p, BlockCache* c = nullptr) {
+        path = p;
+        cache = c;
+        FrameCursor cur;
+        if (!cur.open(path, /*headers=*/true)) return false;
+        F = cur.F;
+        start = cur.off;
+        first_lsn = cur.scan.first_seq;
+        while (cur.next()) add_frame(cur.lsn, cur.frame_offset);
+        if (cur.off < cur.end) return false;
+        end = cur.end;
+        next_lsn = max(cur.next_ordinal, cur.scan.next_seq);
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        if (cache) seg = cache->new_segment();
+        pin_tail();
+        return true;
+    }
+    ~RecordReader() {
+        if (cache) cache->erase_segment(seg);
+        if (fd >= 0) ::close(fd);
+    }
+
+    void add_frame(uint64_t lsn, uint64_t off) {
+        if (frames++ % INDEX_EVERY == 0) index.emplace_back(lsn, off);
+    }
+
+    void pin_tail() {
+        if (!cache || end == 0) return;
+        uint64_t b = (end - 1) / cache->block_size;
+        uint32_t need = (uint32_t)(end - b * cache->block_size);
+        if (b == tail_block) {
+            cache->get(seg, fd, b, need); // refresh the grown copy
+            return;
+        }
+        cache->get(seg, fd, b, need, /*pin=*/true);
+        if (tail_block != UINT64_MAX) cache->unpin(seg, tail_block);
+        tail_block = b;
+    }
+
+    bool read_bytes(uint64_t off, uint8_t* out, uint64_t n) {
+        if (!cache) {
+            preads++;
+            return ::pread(fd, out, n, (off_t)off) == (ssize_t)n;
+        }
+        const uint64_t bs = cache->block_size;
+        while (n > 0) {
+            uint64_t b = off / bs, in = off - b * bs, take = min<uint64_t>(n, bs - in);
+            BlockCache::Block blk = cache->get(seg, fd, b, (uint32_t)(in + take));
+            if (blk->size() < in + take) return false;
+            memcpy(out, blk->data() + in, take);
+            out += take;
+            off += take;
+            n -= take;
+        }
+        return true;
+    }
+
+    // Reads and checks the frame at `off`; `next_off` is set to the offset
+    // of the following frame.
+    bool read_at(uint64_t off, vector<uint8_t>& payload, uint64_t* lsn = nullptr, uint64_t* next_off = nullptr) {
+        if (off < start || off + 4 > end) return false;
+        uint8_t lb[4];
+        if (!read_bytes(off, lb, 4)) return false;
+        uint32_t len = load_be32(lb);
+        if (!len_plausible(len) || off + F.frame_size(len) > end) return false;
+        vector<uint8_t> body(F.ext_bytes() + len + 4);
+        if (!read_bytes(off + 4, body.data(), body.size())) return false;
+        FrameInfo fi;
+        if (!check_frame_body(F, body.data(), len, fi)) return false;
+        payload.assign(body.begin() + F.ext_bytes(), body.end() - 4);
+        if (lsn && (F.flags & FMT_SEQ)) *lsn = fi.seq;
+        if (next_off) *next_off = off + F.frame_size(len);
+        return true;
+    }
+
+    // Offset of the frame with LSN `lsn`; false if it is not in the log.
+    bool find(uint64_t lsn, uint64_t& off) {
+        if (lsn < first_lsn || lsn >= next_lsn || index.empty()) return false;
+        auto it = upper_bound(index.begin(), index.end(), make_pair(lsn, UINT64_MAX));
+        if (it == index.begin()) return false;
+        --it;
+        uint64_t cur = it->first;
+        off = it->second;
+        uint8_t h[4 + MAX_EXT_BYTES];
+        while (off < end) {
+            if (!read_bytes(off, h, 4 + F.ext_bytes())) return false;
+            if (F.flags & FMT_SEQ) cur = load_be64(h + 4 + F.seq_offset());
+            if (cur == lsn) return true;
+            if (cur > lsn) return false; // gap (a stripe holds a subset)
+            off += F.frame_size(load_be32(h));
+            cur++;
+        }
+        return false;
+    }
+
+    bool read_lsn(uint64_t lsn, vector<uint8_t>& payload) {
+        uint64_t off = 0;
+        return find(lsn, off) && read_at(off, payload);
+    }
+
+    // Picks up complete frames appended since open (or the last refresh).
+    uint64_t refresh() {
+        struct stat st;
+        if (::fstat(fd, &st) != 0) return 0;
+        uint64_t sz = (uint64_t)st.st_size, added = 0;
+        uint64_t saved_end = end;
+        end = sz;
+        vector<uint8_t> payload;
+        uint64_t off = saved_end, next = 0, lsn = next_lsn;
+        while (off < sz && read_at(off, payload, &lsn, &next)) {
+            add_frame(lsn, off);
+            next_lsn = lsn + 1;
+            lsn = next_lsn;
+            off = next;
+            added++;
+        }
+        end = off;
+        pin_tail();
+        return added;
+    }
+};
+
+// Random LSN lookups among the newest `lookback` records from `threads`
+// threads; returns lookups per second.
+static double lookup_bench(RecordReader& rd, uint64_t lookups, uint64_t lookback, unsigned threads) {
+    uint64_t hi = rd.next_lsn, lo = hi - min(lookback, hi - rd.first_lsn);
+    if (hi == lo || threads == 0) return 0;
+    atomic<uint64_t> failed{0};
+    auto t0 = chrono::steady_clock::now();
+    vector<thread> ts;
+    for (unsigned t = 0; t < threads; ++t) {
+        ts.emplace_back([&, t] {
+            uint64_t x = 0x9E3779B97F4A7C15ull * (t + 1);
+            vector<uint8_t> payload;
+            for (uint64_t i = t; i < lookups; i += threads) {
+                x ^= x << 13; x ^= x >> 7; x ^= x << 17; // xorshift64
+                if (!rd.read_lsn(lo + x % (hi - lo), payload)) failed++;
+            }
+        });
+    }
+    for (auto& t : ts) t.join();
+    double ms = ms_since(t0);
+    if (failed) cerr << "[lookup] " << failed.load() << " lookups failed\n";
+    return ms > 0 ? lookups * 1000.0 / ms : 0;
+}
+
+// ----------- Time-range reads -----------
+struct TimeReadStats {
+    uint64_t index_entries = 0;  // usable entries in `<log>.tidx`
+    uint64_t seek_offset = 0;    // where the scan started
+    bool index_miss = false;     // the entry did not match its frame; scanned from the start
+    uint64_t skipped = 0;        // frames read before `since`
+    uint64_t records = 0;        // records passed to the callback
+    double ms = 0;
+};
+
+using TimeRecordFn = function<bool(uint64_t lsn, uint64_t ts, const uint8_t* payload, uint32_t len)>;
+
+// Calls `fn` for each record with since <= ts <= until, in log order, after
+// seeking with the time index: the scan starts at the last entry older than
+// `since`, so at most TIDX_EVERY frames are read before the first match. It
+// stops after `until` (timestamps never decrease) or at the first bad frame.
+static bool read_time_range(const string& path, uint64_t since, uint64_t until, const TimeRecordFn& fn,
+                            TimeReadStats& st) {
+    auto t0 = chrono::steady_clock::now();
+    MappedFile m;
+    if (!m.open(path)) {
+        cerr << "[read] cannot open/map " << path << "\n";
+        return false;
+    }
+    LogFormat F;
+    if (parse_log_header(m.data, m.size, F) != HeaderStatus::Ok || (F.flags & FMT_CIRCULAR)) {
+        cerr << "[read] unsupported log (torn header or circular)\n";
+        return false;
+    }
+    bool timed = (F.flags & FMT_TIME) != 0;
+    if (!timed && (since > 0 || until != UINT64_MAX)) {
+        cerr << "[read] log has no timestamps (create it with --timestamps)\n";
+        return false;
+    }
+    const uint8_t* base = m.data;
+    uint64_t sz = m.size, start = F.data_start(), lsn = 0;
+    LogStart LS;
+    if (load_log_start(path, LS) && LS.offset >= start && LS.offset <= sz) {
+        start = LS.offset;
+        lsn = LS.lsn;
+    }
+    uint64_t off = start;
+    vector<TimeIndexEntry> idx;
+    if (timed && since > 0 && load_time_index(time_index_path(path), idx)) {
+        idx.erase(remove_if(idx.begin(), idx.end(),
+                            [&](const TimeIndexEntry& e) { return e.offset < start || e.offset >= sz; }),
+                  idx.end());
+        st.index_entries = idx.size();
+        auto it = lower_bound(idx.begin(), idx.end(), since,
+                              [](const TimeIndexEntry& e, uint64_t t) { return e.ts < t; });
+        if (it != idx.begin()) {
+            --it;
+            bool ok = frame_valid_at(F, base, sz, it->offset) &&
+                      load_be64(base + it->offset + 4 + F.time_offset()) == it->ts &&
+                      (!(F.flags & FMT_SEQ) || load_be64(base + it->offset + 4 + F.seq_offset()) == it->lsn);
+            if (ok) {
+                off = it->offset;
+                lsn = it->lsn;
+            } else {
+                st.index_miss = true;
+            }
+        }
+    }
+    st.seek_offset = off;
+    for (uint64_t n; (n = frame_valid_at(F, base, sz, off)) != 0; off += n, ++lsn) {
+        const uint8_t* ext = base + off + 4;
+        if (F.flags & FMT_SEQ) lsn = load_be64(ext + F.seq_offset());
+        uint64_t ts = timed ? load_be64(ext + F.time_offset()) : 0;
+        if (ts > until) break;
+        if (ts < since) {
+            st.skipped++;
+            continue;
+        }
+        st.records++;
+        if (!fn(lsn, ts, ext + F.ext_bytes(), load_be32(base + off))) break;
+    }
+    st.ms = ms_since(t0);
+    return true;
+}
+
+// Accepts seconds since the epoch ("1700000000.5"), or local time as
+// "YYYY-MM-DD HH:MM[:SS]", "YYYY-MM-DDTHH:MM[:SS]" or "HH:MM[:SS]" (today).
+static bool parse_time_arg(const string& s, uint64_t& us) {
+    if (!s.empty() && s.find_first_not_of("0123456789.") == string::npos) {
+        us = (uint64_t)(stod(s) * 1e6);
+        return true;
+    }
+    time_t now = ::time(nullptr);
+    struct tm tm;
+    ::localtime_r(&now, &tm);
+    tm.tm_sec = 0;
+    const char* p = s.c_str();
+    const char* end = nullptr;
+    for (const char* f : {"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%dT%H:%M",
+                          "%H:%M:%S", "%H:%M"}) {
+        struct tm t = tm;
+        end = ::strptime(p, f, &t);
+        if (end && *end == 0) {
+            t.tm_isdst = -1;
+            time_t v = ::mktime(&t);
+            if (v < 0) return false;
+            us = (uint64_t)v * 1000000;
+            return true;
+        }
+    }
+    return false;
+}
+
+static string format_time_us(uint64_t us) {
+    time_t sec = (time_t)(us / 1000000);
+    struct tm tm;
+    ::localtime_r(&sec, &tm);
+    char b[32], out[48];
+    ::strftime(b, sizeof b, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(out, sizeof out, "%s.%06u", b, (unsigned)(us % 1000000));
+    return out;
+}
+
+// ----------- Circular logs -----------
+// A circular log is created at its final size (zero-filled, so even the first
+// lap causes no allocation) and overwritten in place. After a crash the ring
+// holds, from its start: the newest run of frames (A), the torn remains of the
+// frame being written, then the surviving older run (B) up to the previous
+// lap's wrap marker. The tail is the end of A; the head is the start of B when
+// B's last sequence number is exactly one below A's first, else the ring start.
+static bool create_circular_log(const string& path, uint64_t capacity) {
+    if (fs::exists(path) && fs::file_size(path) > 0) {
+        cerr << "[circular] " << path << " already exists\n";
+        return false;
+    }
+    if (capacity < LOG_HEADER_BYTES + 64) return false;
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    vector<uint8_t> zeros(1 << 20, 0);
+    store_be32(zeros.data(), LOG_MAGIC);
+    store_be32(zeros.data() + 4, FMT_SEQ | FMT_CIRCULAR);
+    bool ok = true;
+    for (uint64_t off = 0; ok && off < capacity; off += zeros.size()) {
+        size_t n = (size_t)min<uint64_t>(zeros.size(), capacity - off);
+        ok = ::pwrite(fd, zeros.data(), n, (off_t)off) == (ssize_t)n;
+        if (off == 0) memset(zeros.data(), 0, LOG_HEADER_BYTES);
+    }
+    ok = ok && ::fsync(fd) == 0;
+    ::close(fd);
+    return ok && fsync_path(parent_dir(path));
+}
+
+static void scan_circular(const string& path, const LogFormat& F, ScanResult& R, Env& env) {
+    MappedFile m;
+    vector<uint8_t> copy; // other envs: the ring is read whole
+    if (env.is_posix() ? !m.open(path) : !env.read_file(path, copy)) {
+        cerr << "[recover] cannot open/map " << path << "\n";
+        return;
+    }
+    const uint8_t* base = env.is_posix() ? m.data : copy.data();
+    uint64_t sz = env.is_posix() ? m.size : copy.size(), start = F.data_start();
+    auto seq_at = [&](uint64_t at) { return load_be64(base + at + 4 + F.seq_offset()); };
+
+    // run A: newest frames from the ring start
+    uint64_t pos = start, a_count = 0, a_first = 0, a_last = 0;
+    for (uint64_t n; (n = frame_valid_at(F, base, sz, pos)) != 0; pos += n) {
+        uint64_t q = seq_at(pos);
+        if (a_count > 0 && q != a_last + 1) break; // older frame at an aligned offset
+        if (a_count == 0) a_first = q;
+        a_last = q;
+        a_count++;
+        R.last_frame_offset = pos;
+    }
+    uint64_t tail = pos;
+
+    // run B: first valid frame at or after the tail, then consecutive frames
+    SalvageResult unused;
+    uint64_t q_off = frame_valid_at(F, base, sz, tail) ? tail : resync(F, base, sz, tail, unused);
+    uint64_t b_count = 0, b_first = 0, b_last = 0;
+    for (uint64_t o = q_off, n; o < sz && (n = frame_valid_at(F, base, sz, o)) != 0; o += n) {
+        uint64_t q = seq_at(o);
+        if (b_count > 0 && q != b_last + 1) break;
+        if (b_count == 0) b_first = q;
+        b_last = q;
+        b_count++;
+    }
+    bool b_ok = b_count > 0 && (a_count == 0 || b_last + 1 == a_first);
+
+    R.head_offset = b_ok ? q_off : start;
+    R.last_good_offset = tail;
+    R.good_records = a_count + (b_ok ? b_count : 0);
+    R.first_seq = b_ok ? b_first : a_first;
+    R.next_seq = a_count ? a_last + 1 : (b_ok ? b_last + 1 : 0);
+    // leftovers of an overwritten older frame are normal at the tail; a
+    // plausible header carrying the next sequence number is a torn write
+    R.clean = !(header_plausible(F, base, sz, tail) && tail + 4 + F.ext_bytes() <= sz &&
+                seq_at(tail) == R.next_seq);
+}
+
+// ----------- Striped logs -----------
+// One logical log spread over N FMT_SEQ files (ideally on different
+// devices): every record carries a global sequence number, each batch goes
+// to one stripe, and each stripe is synced on its own thread. Readers merge
+// the stripes by sequence number; recovery keeps the longest prefix of the
+// global sequence that has no gap.
+
+// K-way merge of stripe cursors by sequence number. Stops at the first gap
+// in the global sequence; `next_seq` is then the first missing number.
+// With `contiguous` off (ordered lanes, whose numbers are timestamps) it
+// only merges.
+struct StripeMerge {
+    vector<unique_ptr<FrameCursor>> cursors;
+    vector<pair<uint64_t, size_t>> heap; // min-heap of (lsn, cursor) with a current frame
+    uint64_t next_seq = 0;
+    bool contiguous = true;
+    bool gap = false;
+    size_t cur = 0; // cursor holding the current record
+
+    // `scans`, when given, are the stripes' scan results from recovery.
+    // The merge starts at the log's persisted logical start: 0 unless
+    // stripes were trimmed. A trimmed stripe's `.start` lsn is the first
+    // number it kept, or its own next number when it kept nothing, so it
+    // bounds the start from above or from below. Stripes never trimmed bound
+    // nothing; empty or not, they stay in the merge and expose any gap.
+    bool open(const vector<string>& paths, bool headers_only = false, const vector<ScanResult>* scans = nullptr) {
+        uint64_t lo = 0, hi = UINT64_MAX;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            cursors.emplace_back(new FrameCursor);
+            FrameCursor& c = *cursors.back();
+            uint64_t sz = 0;
+            if (posix_env().file_size(paths[i], sz) && sz == 0) {
+                // crashed before its header was durable: an empty SEQ stripe
+                c.F.flags = FMT_SEQ;
+                continue;
+            }
+            if (!c.open(paths[i], headers_only, scans ? &(*scans)[i] : nullptr) || !(c.F.flags & FMT_SEQ)) {
+                cerr << "[stripe] " << paths[i] << " is not a linear SEQ log\n";
+                return false;
+            }
+            bool kept = c.next();
+            if (kept) heap.emplace_back(c.lsn, i);
+            LogStart LS;
+            if (!load_log_start(paths[i], LS)) continue;
+            if (kept) hi = min(hi, LS.lsn);
+            else lo = max(lo, LS.lsn);
+        }
+        next_seq = hi == UINT64_MAX ? lo : max(lo, hi);
+        make_heap(heap.begin(), heap.end(), greater<pair<uint64_t, size_t>>());
+        return true;
+    }
+
+    // Advances to the next record in global order; false at the end of the
+    // contiguous prefix.
+    bool next() {
+        if (heap.empty()) return false;
+        pop_heap(heap.begin(), heap.end(), greater<pair<uint64_t, size_t>>());
+        auto top = heap.back();
+        if (contiguous && top.first != next_seq) {
+            push_heap(heap.begin(), heap.end(), greater<pair<uint64_t, size_t>>());
+            gap = true;
+            return false;
+        }
+        heap.pop_back();
+        cur = top.second;
+        next_seq = top.first + 1;
+        return true;
+    }
+
+    FrameCursor& current() { return *cursors[cur]; }
+
+    // Refills the heap from the current record's stripe; call after using it.
+    void advance() {
+        FrameCursor& c = *cursors[cur];
+        if (c.next()) {
+            heap.emplace_back(c.lsn, cur);
+            push_heap(heap.begin(), heap.end(), greater<pair<uint64_t, size_t>>());
+        }
+    }
+};
+
+struct StripeRecovery {
+    vector<ScanResult> scans;
+    vector<uint64_t> cut_bytes;  // bytes dropped from each stripe beyond the gap
+    uint64_t next_seq = 0;       // end of the contiguous prefix
+    uint64_t orphan_records = 0; // records after the gap that were dropped
+};
+
+// Recovers every stripe (truncating torn tails), then cuts each stripe back
+// to the globally contiguous prefix: a record whose predecessor in global
+// order never became durable on its stripe is dropped with all later ones.
+// All truncations are synced as one batch.
+static bool recover_stripes(const vector<string>& paths, StripeRecovery& SR) {
+    SyncBatch batch;
+    for (const auto& p : paths) SR.scans.push_back(scan_and_maybe_truncate(p, /*perform_truncate=*/true, &batch));
+    StripeMerge M;
+    if (!M.open(paths, /*headers_only=*/true, &SR.scans)) return false;
+    while (M.next()) M.advance();
+    SR.next_seq = M.next_seq;
+    SR.cut_bytes.assign(paths.size(), 0);
+    bool ok = true;
+    for (auto& h : M.heap) {
+        // everything from this stripe's current frame on lies beyond the gap
+        FrameCursor& c = *M.cursors[h.second];
+        uint64_t cut = c.frame_offset;
+        SR.orphan_records++;
+        while (c.next()) SR.orphan_records++;
+        SR.cut_bytes[h.second] = c.end - cut;
+        if (truncate_file(paths[h.second], cut)) batch.add(paths[h.second]);
+        else ok = false;
+    }
+    return batch.flush() && ok;
+}
+
+struct StripedWal {
+    vector<unique_ptr<WalWriter>> stripes;
+    uint64_t next_seq = 0;
+    size_t next_stripe = 0;
+
+    // Existing stripes are first cut back to the globally contiguous prefix
+    // (a stripe still missing is created empty), so appends continue right
+    // after it instead of after a gap readers would stop at.
+    bool open(const vector<string>& paths) {
+        if (any_of(paths.begin(), paths.end(), [](const string& p) { return fs::exists(p); })) {
+            for (const auto& p : paths) {
+                if (!fs::exists(p)) ofstream(p, ios::binary);
+            }
+            StripeRecovery SR;
+            if (!recover_stripes(paths, SR)) return false;
+            next_seq = SR.next_seq;
+        }
+        for (const auto& p : paths) {
+            stripes.emplace_back(new WalWriter(p, FMT_SEQ));
+            const WalWriter& w = *stripes.back();
+            if (!w.is_open() || (w.format.flags & (FMT_SEQ | FMT_CIRCULAR)) != FMT_SEQ) {
+                cerr << "[stripe] " << p << " is not a linear SEQ log\n";
+                return false;
+            }
+        }
+        return !stripes.empty();
+    }
+
+    // Appends `n` records with consecutive global sequence numbers to the
+    // next stripe in turn.
+    bool append_batch(const vector<uint8_t>* recs, size_t n) {
+        WalWriter& w = *stripes[next_stripe];
+        next_stripe = (next_stripe + 1) % stripes.size();
+        for (size_t i = 0; i < n; ++i) {
+            if (!w.append_record_seq(recs[i].data(), (uint32_t)recs[i].size(), next_seq)) return false;
+            next_seq++;
+        }
+        return true;
+    }
+
+    // Syncs all stripes concurrently: one fdatasync per device in flight.
+    bool sync() {
+        vector<char> ok(stripes.size(), 0);
+        vector<thread> threads;
+        for (size_t i = 0; i < stripes.size(); ++i) {
+            threads.emplace_back([&, i] { ok[i] = stripes[i]->sync(); });
+        }
+        for (auto& t : threads) t.join();
+        return all_of(ok.begin(), ok.end(), [](char c) { return c != 0; });
+    }
+};
+
+// ----------- WAL lanes -----------
+// Independent per-core (or per-thread-group) logs `<base>.lane<i>`, each with
+// its own WalWriter and lock, so appends on different lanes never contend.
+// Unordered lanes are plain logs. Ordered lanes are FMT_SEQ logs whose
+// sequence field holds a hybrid logical timestamp: (wall ms << 20) + counter,
+// strictly increasing per lane and never below a timestamp the caller has
+// observed (`after`), so causally related records sort correctly when the
+// lanes are merged by timestamp.
+static const unsigned HLC_LOGICAL_BITS = 20;
+
+static uint64_t hlc_physical_now() {
+    auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    return (uint64_t)ms << HLC_LOGICAL_BITS;
+}
+
+struct WalLanes {
+    struct Lane {
+        mutex mu;
+        unique_ptr<WalWriter> w;
+        uint64_t hlc = 0; // last timestamp issued on this lane
+    };
+    vector<unique_ptr<Lane>> lanes;
+    bool ordered = false;
+
+    static string lane_path(const string& base, unsigned i) { return base + ".lane" + to_string(i); }
+
+    // Lane files of `base` that exist, in lane order.
+    static vector<string> existing(const string& base) {
+        vector<string> out;
+        for (unsigned i = 0; fs::exists(lane_path(base, i)); ++i) out.push_back(lane_path(base, i));
+        return out;
+    }
+
+    bool open(const string& base, unsigned n, bool want_order) {
+        ordered = want_order;
+        for (unsigned i = 0; i < max(1u, n); ++i) {
+            lanes.emplace_back(new Lane);
+            Lane& L = *lanes.back();
+            L.w.reset(new WalWriter(lane_path(base, i), ordered ? FMT_SEQ : 0));
+            if (!L.w->is_open() || ((L.w->format.flags & FMT_SEQ) != 0) != ordered) {
+                cerr << "[lanes] " << lane_path(base, i) << " cannot be opened as an "
+                     << (ordered ? "ordered" : "unordered") << " lane\n";
+                return false;
+            }
+            if (ordered && L.w->next_seq > 0) L.hlc = L.w->next_seq - 1;
+        }
+        return true;
+    }
+
+    // The calling thread's lane: its current CPU where available.
+    unsigned lane_for_this_thread() const {
+#if defined(__linux__)
+        int cpu = ::sched_getcpu();
+        if (cpu >= 0) return (unsigned)cpu % lanes.size();
+#endif
+        return (unsigned)(hash<thread::id>()(this_thread::get_id()) % lanes.size());
+    }
+
+    // Appends to `lane`. For ordered lanes the record's timestamp exceeds
+    // both the lane's previous one and `after`; it is returned in `ts`.
+    bool append(unsigned lane, const uint8_t* p, uint32_t n, uint64_t after = 0, uint64_t* ts = nullptr) {
+        Lane& L = *lanes[lane % lanes.size()];
+        lock_guard<mutex> lk(L.mu);
+        if (!ordered) return L.w->append_record(p, n);
+        uint64_t t = max(hlc_physical_now(), max(L.hlc, after) + 1);
+        if (!L.w->append_record_seq(p, n, t)) return false;
+        L.hlc = t;
+        if (ts) *ts = t;
+        return true;
+    }
+
+    // Syncs all lanes concurrently.
+    bool sync() {
+        vector<char> ok(lanes.size(), 0);
+        vector<thread> threads;
+        for (size_t i = 0; i < lanes.size(); ++i) {
+            threads.emplace_back([&, i] {
+                lock_guard<mutex> lk(lanes[i]->mu);
+                ok[i] = lanes[i]->w->sync();
+            });
+        }
+        for (auto& t : threads) t.join();
+        return all_of(ok.begin(), ok.end(), [](char c) { return c != 0; });
+    }
+};
+
+// Recovers every lane on up to `jobs` threads; lanes are independent, so
+// there is no cross-lane cut. Truncations are synced as one batch.
+static bool recover_lanes(const vector<string>& paths, unsigned jobs, vector<ScanResult>& results) {
+    SyncBatch batch;
+    results.assign(paths.size(), ScanResult());
+    atomic<size_t> next{0};
+    vector<thread> workers;
+    for (unsigned t = 0; t < min<size_t>(max(1u, jobs), paths.size()); ++t) {
+        workers.emplace_back([&] {
+            for (size_t i; (i = next.fetch_add(1)) < paths.size();) {
+                results[i] = scan_and_maybe_truncate(paths[i], /*perform_truncate=*/true, &batch);
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    return batch.flush();
+}
+
+// ----------- NUMA placement -----------
+// CPU-to-node map from /sys/devices/system/node (no libnuma needed). Anything
+// unreadable, and every non-Linux host, counts as a single node with all CPUs.
+struct NumaTopology {
+    vector<vector<int>> node_cpus; // CPUs of each node
+    vector<int> cpu_node;          // node of each CPU
+
+    static vector<int> parse_cpulist(const string& s) {
+        vector<int> out;
+        stringstream ss(s);
+        string part;
+        while (getline(ss, part, ',')) {
+            if (part.empty() || !isdigit((unsigned char)part[0])) continue;
+            size_t dash = part.find('-');
+            int a = stoi(part.substr(0, dash)), b = dash == string::npos ? a : stoi(part.substr(dash + 1));
+            for (int c = a; c <= b; ++c) out.push_back(c);
+        }
+        return out;
+    }
+
+    static NumaTopology detect() {
+        NumaTopology T;
+#if defined(__linux__)
+        for (int n = 0; n < 1024; ++n) {
+            ifstream f("/sys/devices/system/node/node" + to_string(n) + "/cpulist");
+            if (!f) {
+                if (n > 0 && !fs::exists("/sys/devices/system/node/node" + to_string(n + 1))) break;
+                continue; // node numbers may have holes
+            }
+            string line;
+            getline(f, line);
+            vector<int> cpus = parse_cpulist(line);
+            if (cpus.empty()) continue; // memory-only node
+            T.node_cpus.push_back(cpus);
+        }
+#endif
+        if (T.node_cpus.empty()) {
+            T.node_cpus.emplace_back();
+            for (unsigned c = 0; c < max(1u, thread::hardware_concurrency()); ++c) T.node_cpus[0].push_back((int)c);
+        }
+        for (size_t n = 0; n < T.node_cpus.size(); ++n) {
+            for (int c : T.node_cpus[n]) {
+                if ((size_t)c >= T.cpu_node.size()) T.cpu_node.resize(c + 1, 0);
+                T.cpu_node[c] = (int)n;
+            }
+        }
+        return T;
+    }
+
+    size_t nodes() const { return node_cpus.size(); }
+
+    // Node of the CPU the caller runs on (0 when unknown).
+    unsigned current_node() const {
+#if defined(__linux__)
+        int cpu = ::sched_getcpu();
+        if (cpu >= 0 && (size_t)cpu < cpu_node.size()) return (unsigned)cpu_node[cpu];
+#endif
+        return 0;
+    }
+
+    // Restricts the calling thread to the CPUs of `node`. A no-op on single-node
+    // hosts, where pinning would only take freedom away from the scheduler.
+    bool pin_current_thread(unsigned node) const {
+#if defined(__linux__)
+        if (nodes() < 2 || node >= nodes()) return false;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c : node_cpus[node]) {
+            if (c < CPU_SETSIZE) CPU_SET(c, &set);
+        }
+        return ::sched_setaffinity(0, sizeof set, &set) == 0;
+#else
+        (void)node;
+        return false;
+#endif
+    }
+};
+
+// One lane (`<base>.lane<node>`) and one group committer per NUMA node. The
+// flusher, which frames and checksums the records, is pinned to its node and
+// touches the writer's frame buffer first, so the kernel's first-touch policy
+// places that buffer on the node too. Producers commit through the committer
+// of the node they run on, so queued copies are allocated node-locally and
+// no record crosses the interconnect before it reaches the page cache.
+struct NumaCommitters {
+    NumaTopology topo;
+    vector<unique_ptr<WalWriter>> writers;
+    vector<unique_ptr<GroupCommitter>> committers;
+    vector<char> pinned;
+
+    bool open(const string& base, GroupCommitOptions o = GroupCommitOptions()) {
+        topo = NumaTopology::detect();
+        pinned.assign(topo.nodes(), 0);
+        for (unsigned n = 0; n < topo.nodes(); ++n) {
+            writers.emplace_back(new WalWriter(WalLanes::lane_path(base, n)));
+            if (!writers.back()->is_open()) {
+                cerr << "[numa] cannot open " << WalLanes::lane_path(base, n) << "\n";
+                return false;
+            }
+            // the flusher starts while later writers are still being added:
+            // it must not index `writers`
+            WalWriter* w = writers.back().get();
+            committers.emplace_back(new GroupCommitter(*w, o, [this, n, w] {
+                pinned[n] = topo.pin_current_thread(n);
+                w->frame.assign(1 << 20, 0); // first touch from the pinned thread
+                w->frame.clear();
+            }));
+        }
+        return true;
+    }
+
+    bool commit(const uint8_t* p, uint32_t n, CommitClass c = CommitClass::Urgent) {
+        return committers[topo.current_node() % committers.size()]->commit(p, n, c);
+    }
+
+    void close() {
+        for (auto& gc : committers) gc->close();
+    }
+};
+
+// ----------- Replication (ship / receive) -----------
+// A follower (`receive`) recovers its copy, listens, and on connect sends its
+// durable size as a u64. The primary (`ship`) then streams raw log bytes from
+// that offset with sendfile(), only ever up to the end of the last complete
+// frame. The follower validates each frame with check_frame_body(), appends
+// it through WalWriter, fdatasyncs and acks the new durable size (u64).
+// Addresses are "unix:<path>" or "<ipv4>:<port>".
+
+static double cpu_ms() {
+    struct rusage ru;
+    ::getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+// Fills either a sockaddr_un or sockaddr_in from `addr`; returns the family or -1.
+static int parse_addr(const string& addr, sockaddr_storage& ss, socklen_t& len) {
+    memset(&ss, 0, sizeof ss);
+    if (addr.rfind("unix:", 0) == 0) {
+        auto* un = reinterpret_cast<sockaddr_un*>(&ss);
+        string p = addr.substr(5);
+        if (p.size() >= sizeof un->sun_path) return -1;
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, p.c_str(), p.size() + 1);
+        len = sizeof *un;
+        return AF_UNIX;
+    }
+    size_t colon = addr.rfind(':');
+    if (colon == string::npos) return -1;
+    auto* in = reinterpret_cast<sockaddr_in*>(&ss);
+    in->sin_family = AF_INET;
+    in->sin_port = htons((uint16_t)stoi(addr.substr(colon + 1)));
+    if (::inet_pton(AF_INET, addr.substr(0, colon).c_str(), &in->sin_addr) != 1) return -1;
+    len = sizeof *in;
+    return AF_INET;
+}
+
+static void set_nodelay(int s, int family) {
+    if (family != AF_INET) return;
+    int one = 1;
+    ::setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+}
+
+static bool recv_exact(int s, void* buf, size_t n) {
+    char* p = static_cast<char*>(buf);
+    while (n > 0) {
+        ssize_t r = ::recv(s, p, n, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        n -= (size_t)r;
+    }
+    return true;
+}
+
+static bool send_u64(int s, uint64_t v) {
+    uint8_t b[8];
+    store_be64(b, v);
+    return write_all_fd(s, b, sizeof b);
+}
+
+// Largest offset <= `sz` that ends a run of complete, CRC-valid frames,
+// walking from `from` (a frame boundary). Sets `corrupt` when the walk stops
+// at a frame that lies wholly below `sz` but fails its CRC; the follower
+// still does the chain checks.
+static uint64_t complete_frames_end(int fd, const LogFormat& F, uint64_t from, uint64_t sz, bool& corrupt) {
+    uint64_t off = from;
+    uint8_t b[4];
+    vector<uint8_t> body;
+    corrupt = false;
+    while (off + 4 <= sz) {
+        if (::pread(fd, b, 4, (off_t)off) != 4) break;
+        uint32_t len = load_be32(b);
+        if (!len_plausible(len) || off + F.frame_size(len) > sz) {
+            corrupt = len != 0 && off + F.frame_size(len) <= sz; // an implausible length
+            break;
+        }
+        body.resize(F.ext_bytes() + len + 4);
+        FrameInfo fi;
+        if (::pread(fd, body.data(), body.size(), (off_t)(off + 4)) != (ssize_t)body.size()) break;
+        if (!check_frame_body(F, body.data(), len, fi)) {
+            corrupt = true;
+            break;
+        }
+        off += F.frame_size(len);
+    }
+    return off;
+}
+
+// Zero-copy file -> socket; falls back to pread+write off Linux.
+static bool send_file_range(int sock, int fd, uint64_t off, uint64_t n) {
+#if defined(__linux__)
+    off_t o = (off_t)off;
+    while (n > 0) {
+        ssize_t w = ::sendfile(sock, fd, &o, (size_t)min<uint64_t>(n, 1u << 30));
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        n -= (uint64_t)w;
+    }
+    return true;
+#else
+    vector<uint8_t> buf(1 << 20);
+    while (n > 0) {
+        ssize_t r = ::pread(fd, buf.data(), (size_t)min<uint64_t>(n, buf.size()), (off_t)off);
+        if (r <= 0 || !write_all_fd(sock, buf.data(), (size_t)r)) return false;
+        off += (uint64_t)r;
+        n -= (uint64_t)r;
+    }
+    return true;
+#endif
+}
+
+struct ShipStats {
+    uint64_t shipped_bytes = 0;
+    uint64_t acked = 0;
+    double max_lag_ms = 0;  // send -> ack latency of a shipped range
+    double sum_lag_ms = 0;
+    uint64_t lag_samples = 0;
+    double cpu_ms = 0;
+    double wall_ms = 0;
+};
+
+// Streams complete frames of `path` to the follower at `addr`, never past
+// the durable end the writer published (`<log>.durable`), so a follower
+// cannot hold records a crashed primary lost. For a log without one (no
+// writer has synced it) the shipper syncs the file itself before sending.
+// Without `follow`, returns once the follower has acked everything durable
+// at start; with it, keeps tailing the file until the follower disconnects.
+static bool ship_log(const string& path, const string& addr, bool follow, ShipStats& st) {
+    ::signal(SIGPIPE, SIG_IGN);
+    sockaddr_storage ss;
+    socklen_t sl = 0;
+    int family = parse_addr(addr, ss, sl);
+    if (family < 0) { cerr << "[ship] bad address " << addr << "\n"; return false; }
+    int s = ::socket(family, SOCK_STREAM, 0);
+    if (s < 0 || ::connect(s, reinterpret_cast<sockaddr*>(&ss), sl) != 0) {
+        cerr << "[ship] cannot connect to " << addr << "\n";
+        if (s >= 0) ::close(s);
+        return false;
+    }
+    set_nodelay(s, family);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    uint64_t off = 0;
+    if (fd < 0 || !recv_exact(s, &off, 8)) { ::close(s); if (fd >= 0) ::close(fd); return false; }
+    off = load_be64(reinterpret_cast<uint8_t*>(&off));
+
+    auto t0 = chrono::steady_clock::now();
+    double c0 = cpu_ms();
+    uint8_t hdr[LOG_HEADER_BYTES];
+    ssize_t hn = ::pread(fd, hdr, sizeof hdr, 0);
+    LogFormat F;
+    if (hn < 0 || parse_log_header(hdr, (uint64_t)hn, F) != HeaderStatus::Ok) {
+        cerr << "[ship] unsupported or torn log header\n";
+        ::close(fd); ::close(s);
+        return false;
+    }
+    if (F.flags & FMT_CIRCULAR) {
+        cerr << "[ship] circular logs are not supported\n";
+        ::close(fd); ::close(s);
+        return false;
+    }
+    uint64_t sz0 = fs::file_size(path);
+    if (off > sz0) { cerr << "[ship] follower is ahead of primary (" << off << " > " << sz0 << ")\n"; ::close(fd); ::close(s); return false; }
+    LogStart LS;
+    if (load_log_start(path, LS) && LS.offset > F.data_start() && off < LS.offset) {
+        // the bytes the follower needs were released by trim
+        cerr << "[ship] follower at " << off << " is behind the trimmed start " << LS.offset << "\n";
+        ::close(fd); ::close(s);
+        return false;
+    }
+    uint64_t self_synced = 0;
+    // End of the data known durable, at most `sz`.
+    auto durable_end = [&](uint64_t sz) -> uint64_t {
+        uint64_t d = 0;
+        if (load_durable_offset(path, d)) return max(min(d, sz), self_synced);
+        if (sz > self_synced) {
+            if (data_sync(fd) != 0) return self_synced;
+            self_synced = sz;
+        }
+        return self_synced;
+    };
+    // a new follower receives the header as part of the stream
+    uint64_t frames_from = off < F.data_start() ? F.data_start() : off;
+    bool corrupt = false;
+    uint64_t target = complete_frames_end(fd, F, frames_from, durable_end(sz0), corrupt);
+    st.acked = off;
+    vector<pair<uint64_t, chrono::steady_clock::time_point>> inflight; // (end offset, send time)
+    bool ok = true, damaged = false;
+    while (ok) {
+        uint64_t sz = fs::file_size(path);
+        uint64_t end = complete_frames_end(fd, F, frames_from, durable_end(sz), corrupt);
+        if (end > off) {
+            ok = send_file_range(s, fd, off, end - off);
+            if (!ok) break;
+            st.shipped_bytes += end - off;
+            inflight.emplace_back(end, chrono::steady_clock::now());
+            off = end;
+            frames_from = end;
+        }
+        if (corrupt && !damaged) {
+            // durable but damaged: never shipped, and nothing after it is;
+            // finish once the follower has acked what came before
+            cerr << "[ship] corrupt frame at offset " << end << "; shipping stops there\n";
+            damaged = true;
+            follow = false;
+            target = end;
+        }
+        if (!follow && st.acked >= target) break;
+        // collect acks; wait briefly for new data or acks
+        pollfd p{s, POLLIN, 0};
+        if (::poll(&p, 1, 10) > 0) {
+            uint8_t b[8];
+            if (!recv_exact(s, b, 8)) { if (!follow) ok = false; break; }
+            st.acked = load_be64(b);
+            auto now = chrono::steady_clock::now();
+            size_t k = 0;
+            while (k < inflight.size() && inflight[k].first <= st.acked) {
+                double lag = chrono::duration<double, milli>(now - inflight[k].second).count();
+                st.max_lag_ms = max(st.max_lag_ms, lag);
+                st.sum_lag_ms += lag;
+                st.lag_samples++;
+                ++k;
+            }
+            inflight.erase(inflight.begin(), inflight.begin() + k);
+        }
     }
+    st.cpu_ms = cpu_ms() - c0;
+    st.wall_ms = ms_since(t0);
+    ::close(fd);
+    ::close(s);
+    return ok && !damaged;
 }
-static inline uint32_t crc32(const uint8_t* data, size_t n) {
-    uint32_t c = 0xFFFFFFFFu;
-    for (size_t i=0; i<n; ++i) {
-        c = crc32_table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+
+struct ReceiveStats {
+    uint64_t start_offset = 0;
+    uint64_t durable = 0;
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    double cpu_ms = 0;
+};
+
+// Accepts one primary connection and applies its stream to `path`.
+static bool receive_log(const string& path, const string& addr, ReceiveStats& st) {
+    ::signal(SIGPIPE, SIG_IGN);
+    unique_ptr<WalWriter> w;
+    if (fs::exists(path) && fs::file_size(path) > 0) w.reset(new WalWriter(path)); // cuts a torn tail
+    bool have_local = w && w->size > 0;
+    if (!have_local) w.reset();
+    st.start_offset = st.durable = have_local ? w->size : 0;
+
+    sockaddr_storage ss;
+    socklen_t sl = 0;
+    int family = parse_addr(addr, ss, sl);
+    if (family < 0) { cerr << "[receive] bad address " << addr << "\n"; return false; }
+    if (family == AF_UNIX) ::unlink(reinterpret_cast<sockaddr_un*>(&ss)->sun_path);
+    int ls = ::socket(family, SOCK_STREAM, 0);
+    int one = 1;
+    if (ls >= 0) ::setsockopt(ls, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if (ls < 0 || ::bind(ls, reinterpret_cast<sockaddr*>(&ss), sl) != 0 || ::listen(ls, 1) != 0) {
+        cerr << "[receive] cannot listen on " << addr << "\n";
+        if (ls >= 0) ::close(ls);
+        return false;
     }
-    return c ^ 0xFFFFFFFFu;
-}
+    int s = ::accept(ls, nullptr, nullptr);
+    ::close(ls);
+    if (s < 0) return false;
+    set_nodelay(s, family);
+    double c0 = cpu_ms();
+    bool ok = send_u64(s, st.durable);
 
-// ----------- I/O helpers -----------
-static bool write_all(ofstream& f, const void* buf, size_t n) {
-    f.write(reinterpret_cast<const char*>(buf), n);
-    return bool(f);
+    vector<uint8_t> buf;
+    size_t head = 0; // first unconsumed byte in buf
+    vector<uint8_t> chunk(1 << 20);
+    while (ok) {
+        ssize_t r = ::recv(s, chunk.data(), chunk.size(), 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break; // primary done
+        buf.insert(buf.end(), chunk.begin(), chunk.begin() + r);
+        st.bytes += (uint64_t)r;
+        if (!w) {
+            // new copy: the stream starts with the primary's header (if any)
+            LogFormat F;
+            HeaderStatus hs = parse_log_header(buf.data(), buf.size(), F);
+            if (hs == HeaderStatus::Torn) continue;
+            if (hs == HeaderStatus::Unsupported) { cerr << "[receive] unsupported log header\n"; ok = false; break; }
+            w.reset(new WalWriter(path, F.flags));
+            head = F.data_start();
+        }
+        uint64_t applied = 0;
+        while (buf.size() - head >= 4) {
+            const LogFormat& F = w->format;
+            uint32_t len = load_be32(buf.data() + head);
+            if (!len_plausible(len)) { ok = false; break; }
+            if (buf.size() - head < F.frame_size(len)) break; // wait for the rest
+            FrameInfo fi;
+            const uint8_t* body = buf.data() + head + 4;
+            if (!check_frame_body(F, body, len, fi) ||
+                ((F.flags & FMT_CHAINED) && fi.chain != w->chain) ||
+                ((F.flags & FMT_SEQ) && w->records > 0 && fi.seq < w->next_seq)) {
+                ok = false;
+                break;
+            }
+            // keep the primary's sequence numbers so LSNs match on both sides
+            if (!w->append_record_seq(body + F.ext_bytes(), len, fi.seq, fi.ts)) { ok = false; break; }
+            head += F.frame_size(len);
+            applied++;
+        }
+        if (!ok) { cerr << "[receive] invalid frame at offset " << w->size << "; stopping\n"; }
+        if (head > (1u << 20)) { buf.erase(buf.begin(), buf.begin() + head); head = 0; }
+        if (applied > 0) {
+            if (!w->sync()) { ok = false; break; }
+            st.records += applied;
+            st.durable = w->size;
+            if (!send_u64(s, st.durable)) break;
+        }
+    }
+    st.cpu_ms = cpu_ms() - c0;
+    ::close(s);
+    return ok;
 }
-static bool read_exact(ifstream& f, void* buf, size_t n) {
-    f.read(reinterpret_cast<char*>(buf), n);
-    return size_t(f.gcount()) == n;
+
+// ----------- Corrupt (simulated crash damage) -----------
+static bool corrupt_tail(const string& path, uint64_t cut_bytes, Env& env = posix_env()) {
+    uint64_t sz = 0;
+    if (!env.file_size(path, sz)) return false;
+    if (cut_bytes >= sz) cut_bytes = sz/2;
+    uint64_t new_size = sz - cut_bytes;
+    cout << "[corrupt] truncating " << cut_bytes << " bytes: " << sz << " -> " << new_size << "\n";
+    return truncate_file(path, new_size, env);
 }
 
-// ----------- Writer -----------
-struct WalWriter {
-    string path;
-    WalWriter(string p): path(std::move(p)) {}
-    bool append_record(const vector<uint8_t>& payload) {
-        ofstream f(path, ios::binary | ios::app);
-        if (!f) return false;
-        uint32_t len_be = to_be32((uint32_t)payload.size());
-        uint32_t c = crc32(payload.data(), payload.size());
-        uint32_t crc_be = to_be32(c);
-        if (!write_all(f, &len_be, 4)) return false;
-        if (!write_all(f, payload.data(), payload.size())) return false;
-        if (!write_all(f, &crc_be, 4)) return false;
-        f.flush(); // userspace flush; OS flush optional for demo
-        return bool(f);
-    }
-};
+// Damage shapes seen after real crashes. All but `Flip` hit the last `bytes`
+// of the log (with `extend`, Zero/Garbage/Stale append them instead, as when
+// the size reached the disk ahead of the data):
+// - Cut: the tail is missing (as corrupt_tail).
+// - Torn: the tail was one write whose sectors landed independently; each
+//   `sector`-sized piece of it either made it or still reads as zeros.
+// - Zero: the tail reads as zeros (allocated, never written).
+// - Flip: `bytes` random bits flipped anywhere in the file.
+// - Garbage: the tail holds random bytes.
+// - Stale: the tail holds old frames, as in a recycled file: from the frame
+//   boundary at or before the damage, the log continues with a copy of an
+//   earlier run of its own frames (valid CRCs, wrong history).
+// Every choice is drawn from `seed`, so a variant can be reproduced.
+enum class CorruptMode { Cut, Torn, Zero, Flip, Garbage, Stale };
 
-// ----------- Recovery Scanner -----------
-struct ScanResult {
-    size_t good_records = 0;
-    uint64_t last_good_offset = 0;
-    bool clean = true; // true if no truncation needed
+struct CorruptOptions {
+    CorruptMode mode = CorruptMode::Cut;
+    uint64_t bytes = 0;
+    uint32_t sector = 512;
+    bool extend = false;
+    uint64_t seed = 1;
+    const vector<uint64_t>* frame_starts = nullptr; // Stale: frame offsets of the log, if already known
 };
 
-static bool truncate_file(const string& path, uint64_t new_size) {
-    try {
-        fs::resize_file(path, new_size);
-        return true;
-    } catch (const fs::filesystem_error& e) {
-        cerr << "[recover] truncate error: " << e.what() << "\n";
-        return false;
+static bool parse_corrupt_mode(const string& s, CorruptMode& m) {
+    static const pair<const char*, CorruptMode> names[] = {
+        {"cut", CorruptMode::Cut},   {"torn", CorruptMode::Torn},       {"zero", CorruptMode::Zero},
+        {"flip", CorruptMode::Flip}, {"garbage", CorruptMode::Garbage}, {"stale", CorruptMode::Stale}};
+    for (const auto& n : names) {
+        if (s == n.first) {
+            m = n.second;
+            return true;
+        }
     }
+    return false;
 }
 
-static ScanResult scan_and_maybe_truncate(const string& path, bool perform_truncate=true) {
-    ScanResult R;
+// Offsets of the frames a log's length fields chain through, from its data
+// start; stops at the first implausible length (CRCs are not checked).
+static vector<uint64_t> frame_starts(const string& path, Env& env = posix_env()) {
+    vector<uint64_t> starts;
     uint64_t sz = 0;
-    try {
-        sz = fs::file_size(path);
-    } catch (...) {
-        cerr << "[recover] cannot stat file\n";
-        R.clean = true;
-        return R;
+    unique_ptr<EnvFile> file;
+    if (!env.file_size(path, sz) || !(file = env.open(path, OpenMode::Read))) return starts;
+    ReadAhead f(*file, sz);
+    uint8_t hdr[LOG_HEADER_BYTES];
+    LogFormat F;
+    uint64_t hdr_n = min<uint64_t>(sz, LOG_HEADER_BYTES);
+    if (!f.read(0, hdr, hdr_n) || parse_log_header(hdr, hdr_n, F) != HeaderStatus::Ok) return starts;
+    uint8_t lb[4];
+    for (uint64_t off = F.data_start(); off + 4 <= sz && f.read(off, lb, 4);) {
+        uint32_t len = load_be32(lb);
+        if (!len_plausible(len) || off + F.frame_size(len) > sz) break;
+        starts.push_back(off);
+        off += F.frame_size(len);
     }
+    return starts;
+}
 
-    ifstream f(path, ios::binary);
-    if (!f) {
-        cerr << "[recover] cannot open file\n";
-        R.clean = true;
-        return R;
+// Applies one kind of damage to `path`; `what` describes what was done.
+static bool corrupt_log(const string& path, const CorruptOptions& o, string& what, Env& env = posix_env()) {
+    struct Rng {
+        uint64_t s;
+        uint64_t next() { return mix64(s += 0x9E3779B97F4A7C15ull); }
+        uint64_t below(uint64_t n) { return n ? next() % n : 0; }
+    } rng{o.seed};
+    uint64_t sz = 0;
+    if (!env.file_size(path, sz) || sz == 0) return false;
+    ostringstream msg;
+    if (o.mode == CorruptMode::Cut) {
+        uint64_t cut = o.bytes >= sz ? sz / 2 : o.bytes;
+        msg << "cut " << cut << " bytes: " << sz << " -> " << sz - cut;
+        what = msg.str();
+        return truncate_file(path, sz - cut, env);
+    }
+    unique_ptr<EnvFile> file = env.open(path, OpenMode::Update);
+    if (!file) return false;
+    if (o.mode == CorruptMode::Flip) {
+        msg << "flipped " << o.bytes << " bits at";
+        for (uint64_t i = 0; i < o.bytes; ++i) {
+            uint64_t bit = rng.below(sz * 8);
+            uint8_t b = 0;
+            if (!file->read_at(bit / 8, &b, 1)) return false;
+            b ^= uint8_t(1u << (bit % 8));
+            if (!file->write_at(bit / 8, &b, 1)) return false;
+            if (i < 8) msg << " " << bit / 8 << ":" << bit % 8;
+        }
+        if (o.bytes > 8) msg << " ...";
+        what = msg.str();
+        return true;
     }
 
-    const uint32_t MAX_REC = 32 * 1024 * 1024; // 32MB sanity
-    uint64_t off = 0;
-    while (true) {
-        if (off + 4 > sz) { // no room for len
-            break;
+    bool extend = o.extend && o.mode != CorruptMode::Torn;
+    uint64_t n = extend ? o.bytes : min(o.bytes, sz);
+    uint64_t at = extend ? sz : sz - n;
+    if (n == 0) return false;
+    vector<uint8_t> buf;
+    switch (o.mode) {
+    case CorruptMode::Torn: {
+        // sectors of the device overlapping the tail; a lost one keeps its
+        // bytes before the tail and reads as zeros from there on
+        uint64_t S = max<uint32_t>(o.sector, 1), first = at / S, last = (sz - 1) / S;
+        vector<uint64_t> lost;
+        for (uint64_t s = first; s <= last; ++s) {
+            if (rng.next() & 1) lost.push_back(s);
         }
-        f.seekg(off);
-        uint32_t len_be = 0;
-        if (!read_exact(f, &len_be, 4)) {
-            break;
+        if (lost.empty()) lost.push_back(first + rng.below(last - first + 1));
+        for (uint64_t s : lost) {
+            uint64_t from = max(s * S, at), to = min((s + 1) * S, sz);
+            buf.assign(to - from, 0);
+            if (!file->write_at(from, buf.data(), buf.size())) return false;
         }
-        uint32_t len = from_be32(len_be);
-        if (len == 0 || len > MAX_REC) {
-            // implausible length -> cut here
-            R.clean = false;
-            break;
+        msg << "tore the last " << n << " bytes: lost " << lost.size() << " of " << last - first + 1 << " "
+            << S << "-byte sectors";
+        what = msg.str();
+        return true;
+    }
+    case CorruptMode::Zero:
+        buf.assign(n, 0);
+        msg << (extend ? "appended " : "zeroed ") << n << (extend ? " zero bytes at " : " bytes at ") << at;
+        break;
+    case CorruptMode::Garbage:
+        buf.resize(n);
+        for (auto& b : buf) b = uint8_t(rng.next());
+        msg << (extend ? "appended " : "overwrote ") << n << " random bytes at " << at;
+        break;
+    case CorruptMode::Stale: {
+        vector<uint64_t> own;
+        const vector<uint64_t>& starts = o.frame_starts ? *o.frame_starts : (own = frame_starts(path, env));
+        if (!extend) {
+            // continue from the frame boundary at or before the damage
+            auto it = upper_bound(starts.begin(), starts.end(), at);
+            if (it != starts.begin()) at = *--it;
+            n = sz - at;
         }
-        uint64_t need = (uint64_t)4 + len + 4;
-        if (off + need > sz) {
-            // partial tail
-            R.clean = false;
-            break;
+        // an earlier frame (or, for a log with none, any offset) to copy from
+        uint64_t limit = min(at, sz - min(n, sz));
+        size_t cands = (size_t)(lower_bound(starts.begin(), starts.end(), limit) - starts.begin());
+        uint64_t from = cands ? starts[rng.below(cands)] : rng.below(limit);
+        n = min(n, sz - from);
+        buf.resize(n);
+        if (n == 0 || !file->read_at(from, buf.data(), n)) return false;
+        msg << (extend ? "appended " : "replaced ") << n << " bytes at " << at << " with stale data from " << from;
+        break;
+    }
+    default:
+        return false;
+    }
+    what = msg.str();
+    return file->write_at(at, buf.data(), buf.size());
+}
+
+// Copies `src` to `dst` (replacing it) as cheaply as the file system
+// allows: a reflink sharing the extents copy-on-write, else an in-kernel
+// copy_file_range, else read/write. Returns how, or nullptr on failure.
+static const char* clone_file(const string& src, const string& dst) {
+    int in = ::open(src.c_str(), O_RDONLY);
+    if (in < 0) return nullptr;
+    int out = ::open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        ::close(in);
+        return nullptr;
+    }
+    const char* how = nullptr;
+#if defined(__linux__) && defined(FICLONE)
+    if (::ioctl(out, FICLONE, in) == 0) how = "reflink";
+#endif
+    struct stat st;
+    uint64_t left = ::fstat(in, &st) == 0 ? (uint64_t)st.st_size : 0;
+#if defined(__linux__)
+    while (!how && left > 0) {
+        ssize_t n = ::copy_file_range(in, nullptr, out, nullptr, (size_t)min<uint64_t>(left, 1ull << 30), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break; // unsupported here: finish with read/write
+        left -= (uint64_t)n;
+        if (left == 0) how = "copy_file_range";
+    }
+#endif
+    if (!how) {
+        vector<char> buf(1 << 20);
+        ssize_t n;
+        while ((n = ::read(in, buf.data(), buf.size())) > 0 && write_all_fd(out, buf.data(), (size_t)n)) {}
+        if (n == 0) how = "copy";
+    }
+    ::close(in);
+    if (::close(out) != 0) how = nullptr;
+    return how;
+}
+
+// Sidecars of `path` that exist: checkpoint, logical start, Merkle tree,
+// time index, durable offset, scrub progress and snapshots.
+static vector<string> sidecar_paths(const string& path) {
+    vector<string> out;
+    for (const string& side : {checkpoint_path(path), log_start_path(path), merkle_path(path), time_index_path(path),
+                               durable_path(path), scrub_progress_path(path)}) {
+        if (fs::exists(side)) out.push_back(side);
+    }
+    for (const auto& s : list_snapshots(path)) out.push_back(s.second);
+    return out;
+}
+
+// Clones `src` and all its sidecars to `dst`. Sidecars of `dst` that `src`
+// lacks are removed, so a clone never pairs with metadata of an older one.
+static const char* clone_log(const string& src, const string& dst) {
+    const char* how = clone_file(src, dst);
+    if (!how) return nullptr;
+    // sidecars are named "<log>.<suffix>"; snapshot paths come back from a
+    // directory listing, so the suffix is taken from the file name
+    auto suffix = [](const string& side, const string& log) {
+        return fs::path(side).filename().string().substr(fs::path(log).filename().string().size());
+    };
+    set<string> cloned;
+    for (const string& side : sidecar_paths(src)) {
+        string sfx = suffix(side, src);
+        cloned.insert(sfx);
+        if (!clone_file(side, dst + sfx)) {
+            cerr << "[corrupt] cannot clone " << side << "\n";
+            return nullptr;
         }
-        // read payload+crc
-        vector<uint8_t> payload(len);
-        if (!read_exact(f, payload.data(), len)) {
-            R.clean = false;
-            break;
+    }
+    for (const string& side : sidecar_paths(dst)) {
+        if (!cloned.count(suffix(side, dst))) ::unlink(side.c_str());
+    }
+    return how;
+}
+
+// ----------- Crash-point enumeration -----------
+// Writes a generated workload into a MemEnv, keeping the writes it issued
+// and where each sync fell, then recovers every crash state worth checking:
+// - the log cut at every byte offset (a torn in-order tail);
+// - at every sync boundary, every mix of the writes still unsynced there:
+//   each absent, complete, or torn at a 512-byte sector boundary inside it,
+//   so later writes may land while earlier ones did not. Past `max_states`
+//   mixes per boundary a seeded sample is checked instead.
+// A state's expected outcome is the frames lying wholly inside its longest
+// prefix that matches the final log: recovery must keep exactly those, cut
+// the file right after them, and find the cut log clean on a rescan.
+// States are independent, so all cores recover them, each in its own MemEnv.
+struct CrashTestOptions {
+    uint64_t records = 1000;
+    uint32_t max_payload = 64;     // payload sizes are drawn from [1, max_payload]
+    uint64_t sync_every = 8;
+    uint32_t flags = 0;            // log format
+    bool checkpoints = false;      // checkpoint at each sync (chained logs)
+    uint64_t seed = 1;
+    uint64_t max_states = 1 << 16; // per sync boundary
+    unsigned threads = 1;
+};
+
+struct CrashTestResult {
+    uint64_t log_bytes = 0;
+    uint64_t writes = 0;
+    uint64_t boundaries = 0;       // sync boundaries, plus the unsynced end
+    uint64_t cut_states = 0;
+    uint64_t reorder_states = 0;
+    uint64_t sampled_boundaries = 0;
+    atomic<uint64_t> failures{0};
+    vector<string> first_failures; // up to 10
+    double ms = 0;
+};
+
+static const uint64_t CRASH_SECTOR = 512;
+
+static bool crash_test(const string& path, const CrashTestOptions& opt, CrashTestResult& T) {
+    struct Span { uint64_t off, len; };
+    struct Boundary {
+        uint64_t durable = 0;  // log bytes durable at this boundary
+        size_t first = 0, n = 0; // unsynced writes: writes[first, first + n)
+        int ckpt = -1;         // newest durable checkpoint
+        uint64_t states = 1;
+        bool sampled = false;
+    };
+    vector<Span> writes;
+    vector<Boundary> bounds;
+    vector<uint64_t> frame_end;              // end offset of every record
+    vector<pair<uint64_t, vector<uint8_t>>> ckpts; // (checkpoint offset, sidecar bytes)
+    vector<uint8_t> final_log;
+    LogFormat F;
+    F.flags = opt.flags;
+
+    {
+        MemEnv env;
+        WalWriter w(path, opt.flags, env);
+        if (!w.is_open()) return false;
+        // Collects the writes made since the last sync; `Boundary::durable`
+        // is what a crash right now keeps for sure.
+        auto take_pending = [&]() {
+            lock_guard<mutex> lk(env.mu);
+            shared_ptr<MemEnv::Node> n = env.find(path);
+            Boundary b;
+            b.durable = n->durable.size();
+            b.first = writes.size();
+            for (const auto& pw : n->pending) {
+                if (pw.truncate) return false; // the workload only appends
+                writes.push_back({pw.off, pw.bytes.size()});
+            }
+            b.n = writes.size() - b.first;
+            b.ckpt = (int)ckpts.size() - 1;
+            bounds.push_back(b);
+            return true;
+        };
+        vector<uint8_t> rec(max<uint32_t>(opt.max_payload, 1));
+        uint64_t x = opt.seed;
+        for (uint64_t i = 0; i < opt.records; ++i) {
+            x = mix64(x + i);
+            uint32_t len = 1 + (uint32_t)(x % rec.size());
+            for (uint32_t j = 0; j < len; ++j) rec[j] = uint8_t(mix64(x + j));
+            if (!w.append_record(rec.data(), len)) return false;
+            frame_end.push_back(w.size);
+            if ((i + 1) % opt.sync_every != 0) continue;
+            if (!take_pending()) return false;
+            if (opt.checkpoints && (opt.flags & FMT_CHAINED)) {
+                vector<uint8_t> c;
+                if (!w.checkpoint() || !env.read_file(checkpoint_path(path), c)) return false;
+                ckpts.push_back({w.size, std::move(c)});
+            } else if (!w.sync()) {
+                return false;
+            }
         }
-        uint32_t crc_be=0;
-        if (!read_exact(f, &crc_be, 4)) {
-            R.clean = false;
-            break;
+        if (!take_pending()) return false;
+        if (!env.read_file(path, final_log)) return false;
+    }
+    T.log_bytes = final_log.size();
+    T.writes = writes.size();
+    T.boundaries = bounds.size();
+    T.cut_states = final_log.size() + 1;
+
+    // Write i of a boundary is absent (0), complete (1) or, if it spans a
+    // sector boundary, torn after its last whole sector (2).
+    auto torn_len = [&](const Span& s) {
+        uint64_t cut = (s.off + s.len - 1) / CRASH_SECTOR * CRASH_SECTOR;
+        return cut > s.off ? cut - s.off : 0;
+    };
+    auto choices = [&](const Span& s) -> uint64_t { return torn_len(s) ? 3 : 2; };
+    vector<uint64_t> first_state(bounds.size() + 1);
+    first_state[0] = T.cut_states;
+    for (size_t b = 0; b < bounds.size(); ++b) {
+        Boundary& B = bounds[b];
+        long double total = 1;
+        for (size_t i = 0; i < B.n; ++i) total *= choices(writes[B.first + i]);
+        B.sampled = total > (long double)opt.max_states;
+        B.states = B.sampled ? opt.max_states : (uint64_t)total;
+        T.sampled_boundaries += B.sampled;
+        T.reorder_states += B.states;
+        first_state[b + 1] = first_state[b] + B.states;
+    }
+    uint64_t total_states = first_state.back();
+
+    mutex fail_mu;
+    auto fail = [&](const string& what) {
+        if (T.failures.fetch_add(1) >= 10) return;
+        lock_guard<mutex> lk(fail_mu);
+        T.first_failures.push_back(what);
+    };
+    // Recovers the state in `path` of `env`; returns what went wrong, or ""
+    // if the outcome is the expected one.
+    auto check = [&](MemEnv& env, const vector<uint8_t>& s, int ckpt) -> string {
+        uint64_t same = (uint64_t)(mismatch(s.begin(), s.begin() + min(s.size(), final_log.size()),
+                                            final_log.begin()).first - s.begin());
+        size_t want = (size_t)(upper_bound(frame_end.begin(), frame_end.end(), same) - frame_end.begin());
+        uint64_t want_end = want ? frame_end[want - 1] : same >= F.data_start() ? F.data_start() : 0;
+        if (ckpt >= 0) env.replace_file(checkpoint_path(path), ckpts[ckpt].second.data(), ckpts[ckpt].second.size());
+        else env.remove(checkpoint_path(path));
+        ScanResult R = scan_and_maybe_truncate(path, false, nullptr, nullptr, false, env);
+        if (R.good_records != want || R.last_good_offset != want_end) {
+            ostringstream m;
+            m << "recovered " << R.good_records << " records ending at " << R.last_good_offset
+              << ", expected " << want << " ending at " << want_end;
+            return m.str();
         }
-        uint32_t crc_stored = from_be32(crc_be);
-        uint32_t crc_now = crc32(payload.data(), payload.size());
-        if (crc_stored != crc_now) {
-            // corruption -> cut at off
-            R.clean = false;
-            break;
+        if (R.clean) return "";
+        ScanResult R2;
+        if (truncate_file(path, R.last_good_offset, env)) {
+            R2 = scan_and_maybe_truncate(path, false, nullptr, nullptr, false, env);
         }
-        // good record
-        off += need;
-        R.good_records++;
-        R.last_good_offset = off;
-        if (off == sz) break; // exact end
-    }
+        if (!R2.clean || R2.good_records != want || R2.chain != R.chain) return "rescan after the cut is not clean";
+        return "";
+    };
 
-    if (!R.clean && perform_truncate) {
-        if (truncate_file(path, R.last_good_offset)) {
-            cout << "[recover] truncated tail from offset=" << R.last_good_offset << " to size=" << R.last_good_offset << "\n";
-        } else {
-            cerr << "[recover] truncate failed; file may still have a torn tail\n";
+    auto t0 = chrono::steady_clock::now();
+    atomic<uint64_t> next{0};
+    auto worker = [&]() {
+        // states are built right in the log's node, reusing its buffer
+        MemEnv env;
+        env.replace_file(path, nullptr, 0);
+        shared_ptr<MemEnv::Node> node = env.find(path);
+        vector<uint8_t>& s = node->data;
+        const uint64_t CHUNK = 64;
+        for (;;) {
+            uint64_t from = next.fetch_add(CHUNK);
+            if (from >= total_states) break;
+            for (uint64_t k = from; k < min(from + CHUNK, total_states); ++k) {
+                node->pending.clear();
+                if (k < T.cut_states) {
+                    s.assign(final_log.begin(), final_log.begin() + k);
+                    int ckpt = (int)(upper_bound(ckpts.begin(), ckpts.end(), k, [](uint64_t v, const auto& c) {
+                        return v < c.first;
+                    }) - ckpts.begin()) - 1;
+                    string e = check(env, s, ckpt);
+                    if (!e.empty()) fail("cut at " + to_string(k) + ": " + e);
+                    continue;
+                }
+                size_t b = (size_t)(upper_bound(first_state.begin(), first_state.end(), k) - first_state.begin()) - 1;
+                const Boundary& B = bounds[b];
+                uint64_t code = k - first_state[b];
+                s.assign(final_log.begin(), final_log.begin() + B.durable);
+                string kept; // per write: '-' absent, '+' complete, '/' torn
+                for (size_t i = 0; i < B.n; ++i) {
+                    const Span& w = writes[B.first + i];
+                    uint64_t c = choices(w), pick;
+                    if (B.sampled) {
+                        pick = mix64(opt.seed ^ (k * 0x9E3779B97F4A7C15ull) ^ i) % c;
+                    } else {
+                        pick = code % c;
+                        code /= c;
+                    }
+                    kept += "-+/"[pick];
+                    uint64_t n = pick == 0 ? 0 : pick == 1 ? w.len : torn_len(w);
+                    if (n == 0) continue;
+                    if (s.size() < w.off + n) s.resize(w.off + n);
+                    memcpy(s.data() + w.off, final_log.data() + w.off, n);
+                }
+                string e = check(env, s, B.ckpt);
+                if (!e.empty()) fail("sync boundary " + to_string(b) + " writes [" + kept + "]: " + e);
+            }
         }
-    }
-    return R;
+    };
+    vector<thread> pool;
+    for (unsigned t = 1; t < max(1u, opt.threads); ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+    T.ms = ms_since(t0);
+    return true;
 }
 
-// ----------- Corrupt (truncate bytes from end) -----------
-static bool corrupt_tail(const string& path, uint64_t cut_bytes) {
-    uint64_t sz = fs::file_size(path);
-    if (cut_bytes >= sz) cut_bytes = sz/2;
-    uint64_t new_size = sz - cut_bytes;
-    cout << "[corrupt] truncating " << cut_bytes << " bytes: " << sz << " -> " << new_size << "\n";
-    return truncate_file(path, new_size);
+// ----------- Digest state (snapshot demo) -----------
+// Stand-in for application state: a count and an order-sensitive digest of
+// every payload applied, small enough to snapshot as 16 bytes.
+struct DigestState {
+    uint64_t records = 0;
+    uint64_t digest = 0;
+    bool apply(const uint8_t* p, uint32_t n) {
+        records++;
+        digest = mix64(digest ^ hash64(p, n));
+        return true;
+    }
+    bool restore(const Snapshot& S) {
+        if (S.state.size() != 16) return false;
+        records = load_be64(S.state.data());
+        digest = load_be64(S.state.data() + 8);
+        return true;
+    }
+    void encode(uint8_t out[16]) const {
+        store_be64(out, records);
+        store_be64(out + 8, digest);
+    }
+};
+
+static bool replay_digest(const string& path, DigestState& D, ReplayStats& st) {
+    return replay_from_snapshot(
+        path, [&](const Snapshot& S) { return D.restore(S); },
+        [&](uint64_t, const uint8_t* p, uint32_t n) { return D.apply(p, n); }, st);
 }
 
 // ----------- Demo -----------
@@ -204,7 +4963,9 @@ static int run_demo(const string& path, int N, int payload_bytes) {
 
     // recover
     auto R = scan_and_maybe_truncate(path, /*perform_truncate=*/true);
-    cout << "[recover] scanned " << R.good_records << " good entries\n";
+    cout << "[recover] scanned " << R.good_records << " good entries";
+    if (R.truncated) cout << " (sync_ms=" << R.sync_ms << ")";
+    cout << "\n";
     if (R.clean) {
         cout << "[recover] CLEAN (no action needed)\n";
     } else {
@@ -219,9 +4980,38 @@ int main(int argc, char** argv) {
 
     if (argc < 3) {
         cerr << "Usage:\n"
-             << "  " << argv[0] << " write   <file> <N> <payload_bytes>\n"
+             << "  " << argv[0] << " write   <file> <N> <payload_bytes> [--chained] [--timestamps] [--merkle] [--drop-cache]\n"
+             << "  " << argv[0] << " read    <file> [--since T] [--until T] [--limit N] [--count]\n"
+             << "  " << argv[0] << " checkpoint <file>\n"
+             << "  " << argv[0] << " trim    <file> <lsn> [--collapse]\n"
+             << "  " << argv[0] << " snapshot <file> [--keep-log]\n"
+             << "  " << argv[0] << " restore <file>\n"
+             << "  " << argv[0] << " kv-bench <file> <N> <keys> <value_bytes> [--threads T]\n"
+             << "  " << argv[0] << " stripe-write   <file,file,...> <N> <payload_bytes> [--batch K]\n"
+             << "  " << argv[0] << " stripe-read    <file,file,...>\n"
+             << "  " << argv[0] << " stripe-recover <file,file,...>\n"
+             << "  " << argv[0] << " lanes-write   <base> <lanes> <threads> <N_per_thread> <payload_bytes> [--ordered]\n"
+             << "  " << argv[0] << " lanes-recover <base> [--jobs N]\n"
+             << "  " << argv[0] << " numa-commit <base> <threads> <N_per_thread> <payload_bytes>\n"
+             << "  " << argv[0] << " group-commit <file> <threads> <N_per_thread> <payload_bytes> [--target-ms X] [--think-us U] [--bulk-threads B] [--bulk-bytes X]\n"
+             << "         [--max-queued-mb M] [--max-queued-records R] [--overload block|fail|shed]\n"
+             << "  " << argv[0] << " create-circular <file> <capacity_bytes>\n"
+             << "  " << argv[0] << " merkle-build  <file>\n"
+             << "  " << argv[0] << " merkle-verify <file> [threads]\n"
+             << "  " << argv[0] << " merkle-diff   <file> <replica>\n"
              << "  " << argv[0] << " corrupt <file> <bytes_to_cut>\n"
-             << "  " << argv[0] << " recover <file>\n"
+             << "  " << argv[0] << " corrupt <file> <cut|torn|zero|flip|garbage|stale> <n> [--sector B] [--extend]\n"
+             << "       [--seed S] [--clones K --out DIR]\n"
+             << "  " << argv[0] << " mem-bench <name> <N> <payload_bytes> [--sync-every K] [--chained] [--scans S]\n"
+             << "  " << argv[0] << " crash-test <name> <N> <max_payload> [--sync-every K] [--chained] [--seq]\n"
+             << "       [--timestamps] [--checkpoint] [--seed S] [--max-states M] [--threads T]\n"
+             << "  " << argv[0] << " recover <file> [file...] [--jobs N] [--io-rate MBps] [--drop-cache] [--verify-padding]\n"
+             << "  " << argv[0] << " lookup-bench <file> <lookups> [--cache-mb M] [--block-kb K] [--lookback R] [--threads T]\n"
+             << "  " << argv[0] << " open-append <file> <N> <payload_bytes> [--window MB]\n"
+             << "  " << argv[0] << " salvage <file> <out_file>\n"
+             << "  " << argv[0] << " scrub   <file> [--rate MBps] [--loop secs] [--keep-cache]\n"
+             << "  " << argv[0] << " ship    <file> <addr> [--follow]\n"
+             << "  " << argv[0] << " receive <file> <addr>\n"
              << "  " << argv[0] << " demo    <file> <N> <payload_bytes>\n";
         return 2;
     }
@@ -235,7 +5025,19 @@ int main(int argc, char** argv) {
             if (argc < 5) { cerr << "need N and payload_bytes\n"; return 2; }
             int N = stoi(argv[3]);
             int payload = stoi(argv[4]);
-            WalWriter w(path);
+            bool with_merkle = false, drop_cache = false;
+            uint32_t flags = 0;
+            for (int i = 5; i < argc; ++i) {
+                string opt = argv[i];
+                if (opt == "--chained") flags |= FMT_CHAINED;
+                else if (opt == "--timestamps") flags |= FMT_TIME;
+                else if (opt == "--merkle") with_merkle = true;
+                else if (opt == "--drop-cache") drop_cache = true;
+                else { cerr << "unknown option " << opt << "\n"; return 2; }
+            }
+            WalWriter w(path, flags);
+            w.drop_cache = drop_cache;
+            if (with_merkle && !w.enable_merkle()) { cerr << "[write] cannot open merkle sidecar\n"; return 1; }
             vector<uint8_t> buf(payload);
             for (int i=0;i<N;i++) {
                 for (int j=0;j<payload;j++) buf[j] = uint8_t((i+j) & 0xFF);
@@ -244,27 +5046,802 @@ int main(int argc, char** argv) {
                     return 1;
                 }
             }
+            if (drop_cache && !w.sync()) { cerr << "[write] sync failed\n"; return 1; }
             auto sz = fs::file_size(path);
             cout << "[write] wrote " << N << " entries, bytes=" << sz << "\n";
+            if (drop_cache) cout << "[write] dropped " << w.dropped_bytes << " bytes from page cache\n";
+            if ((w.format.flags & FMT_CHAINED) && !w.checkpoint()) {
+                cerr << "[write] checkpoint failed\n";
+                return 1;
+            }
+            return 0;
+        }
+        else if (mode == "read") {
+            if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
+            uint64_t since = 0, until = UINT64_MAX, limit = UINT64_MAX;
+            bool count_only = false;
+            for (int i = 3; i < argc; ++i) {
+                string o = argv[i];
+                if ((o == "--since" || o == "--until") && i + 1 < argc) {
+                    uint64_t& t = o == "--since" ? since : until;
+                    if (!parse_time_arg(argv[++i], t)) { cerr << "bad time " << argv[i] << "\n"; return 2; }
+                }
+                else if (o == "--limit" && i + 1 < argc) limit = stoull(argv[++i]);
+                else if (o == "--count") count_only = true;
+                else { cerr << "unknown option " << o << "\n"; return 2; }
+            }
+            if (limit == 0) { cerr << "--limit must be at least 1\n"; return 2; }
+            TimeReadStats st;
+            bool ok = read_time_range(path, since, until, [&](uint64_t lsn, uint64_t ts, const uint8_t*, uint32_t len) {
+                if (!count_only) {
+                    cout << "lsn=" << lsn;
+                    if (ts) cout << " time=" << format_time_us(ts);
+                    cout << " len=" << len << "\n";
+                }
+                return --limit > 0;
+            }, st);
+            if (!ok) return 1;
+            cerr << "[read] " << st.records << " records in " << st.ms << " ms; started at offset " << st.seek_offset
+                 << " (" << st.index_entries << " index entries" << (st.index_miss ? ", stale index" : "")
+                 << "), skipped " << st.skipped << " frames\n";
+            return 0;
+        }
+        else if (mode == "merkle-build") {
+            if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
+            WalWriter w(path);
+            if (!w.enable_merkle() || !w.merkle->sync()) { cerr << "[merkle] build failed\n"; return 1; }
+            cout << "[merkle] leaves=" << w.merkle->leaves.size() << " block=" << w.merkle->block_size
+                 << " root=" << hex << MerkleTree(w.merkle->leaves).root() << dec << "\n";
+            return 0;
+        }
+        else if (mode == "merkle-verify") {
+            if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
+            unsigned threads = argc > 3 ? (unsigned)stoul(argv[3]) : max(1u, thread::hardware_concurrency());
+            MerkleVerifyResult V;
+            auto t0 = chrono::steady_clock::now();
+            if (!merkle_verify(path, threads, V)) return 1;
+            double ms = ms_since(t0);
+            print_block_ranges("[merkle] BAD", V.bad_blocks, V.block_size);
+            cout << "[merkle] verified " << V.blocks - V.trimmed_blocks << " blocks of " << V.block_size << " bytes on " << threads
+                 << " threads in " << ms << " ms, bad=" << V.bad_blocks.size()
+                 << ", uncovered tail=" << V.uncovered_bytes << " bytes, trimmed=" << V.trimmed_blocks << "\n";
+            return V.bad_blocks.empty() ? 0 : 1;
+        }
+        else if (mode == "merkle-diff") {
+            if (argc < 4) { cerr << "need replica\n"; return 2; }
+            MerkleDiffResult D;
+            if (!merkle_diff(merkle_path(path), merkle_path(argv[3]), D)) return 2;
+            print_block_ranges("[merkle] DIFF", D.blocks, D.block_size);
+            cout << "[merkle] " << D.blocks.size() << " differing blocks (" << D.leaves_a << " vs " << D.leaves_b
+                 << " leaves, " << D.nodes_read << " nodes read)\n";
+            return D.blocks.empty() ? 0 : 1;
+        }
+        else if (mode == "create-circular") {
+            if (argc < 4) { cerr << "need capacity_bytes\n"; return 2; }
+            uint64_t cap = stoull(argv[3]);
+            if (!create_circular_log(path, cap)) { cerr << "[circular] create failed\n"; return 1; }
+            cout << "[circular] created " << path << " capacity=" << cap << "\n";
+            return 0;
+        }
+        else if (mode == "checkpoint") {
+            if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
+            WalWriter w(path);
+            if (!(w.format.flags & FMT_CHAINED)) { cerr << "checkpoints need a chained log\n"; return 2; }
+            if (!w.checkpoint()) { cerr << "[checkpoint] failed\n"; return 1; }
+            cout << "[checkpoint] offset=" << w.size << " entries=" << w.records << "\n";
+            return 0;
+        }
+        else if (mode == "trim") {
+            if (argc < 4) { cerr << "need lsn\n"; return 2; }
+            if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
+            uint64_t lsn = stoull(argv[3]);
+            bool collapse = argc > 4 && string(argv[4]) == "--collapse";
+            WalWriter w(path);
+            if (w.format.flags & FMT_CIRCULAR) { cerr << "circular logs overwrite their head themselves\n"; return 2; }
+            uint64_t released = 0;
+            if (!w.trim_head(lsn, collapse, released)) { cerr << "[trim] failed\n"; return 1; }
+            cout << "[trim] start offset=" << w.start_offset << " lsn=" << w.first_lsn << " live entries=" << w.records
+                 << " released=" << released << " bytes" << (collapse ? " (collapse)" : "") << "\n";
+            return 0;
+        }
+        else if (mode == "snapshot" || mode == "restore") {
+            if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
+            auto R = scan_and_maybe_truncate(path, /*perform_truncate=*/true);
+            if (!R.clean) cout << "[recover] truncated to " << R.good_records << " entries\n";
+            DigestState D;
+            ReplayStats st;
+            if (!replay_digest(path, D, st)) { cerr << "[" << mode << "] replay failed\n"; return 1; }
+            cout << "[" << mode << "] " << (st.from_snapshot ? "snapshot lsn=" + to_string(st.snapshot_lsn) : string("no snapshot"))
+                 << ", replayed=" << st.replayed << " skipped=" << st.skipped << " in " << st.ms << " ms\n";
+            cout << "[" << mode << "] state: records=" << D.records << " digest=" << hex << D.digest << dec << "\n";
+            if (mode == "restore") return 0;
+            bool trim = !(argc > 3 && string(argv[3]) == "--keep-log");
+            WalWriter w(path);
+            uint8_t enc[16];
+            D.encode(enc);
+            if (!w.snapshot(st.next_lsn, enc, sizeof enc, trim)) { cerr << "[snapshot] failed\n"; return 1; }
+            cout << "[snapshot] stored lsn=" << st.next_lsn << (trim ? ", log trimmed" : "") << "\n";
+            return 0;
+        }
+        else if (mode == "kv-bench") {
+            if (argc < 6) { cerr << "need N, keys and value_bytes\n"; return 2; }
+            uint64_t N = stoull(argv[3]), keys = max<uint64_t>(1, stoull(argv[4]));
+            size_t vbytes = stoul(argv[5]);
+            unsigned threads = max(1u, thread::hardware_concurrency());
+            for (int i = 6; i < argc; ++i) {
+                string a = argv[i];
+                if (a == "--threads" && i + 1 < argc) threads = (unsigned)stoul(argv[++i]);
+                else { cerr << "unknown option " << a << "\n"; return 2; }
+            }
+            if (!fs::exists(path) || fs::file_size(path) == 0) {
+                // mostly puts over `keys` keys, some deletes, one clear halfway
+                WalWriter w(path);
+                vector<uint8_t> rec;
+                string value(vbytes, 'v');
+                for (uint64_t i = 0; i < N; ++i) {
+                    string key = "key" + to_string(mix64(i) % keys);
+                    char op = i == N / 2 ? 'C' : (i % 10 == 9 ? 'D' : 'P');
+                    if (!value.empty()) value[i % value.size()] = char('a' + i % 26);
+                    KvStateMachine::encode(op, key, op == 'P' ? value : string(), rec);
+                    if (!w.append_record(rec)) { cerr << "[kv-bench] write failed\n"; return 1; }
+                }
+                if (!w.sync()) { cerr << "[kv-bench] sync failed\n"; return 1; }
+                cout << "[kv-bench] wrote " << N << " records, bytes=" << fs::file_size(path) << "\n";
+            }
+            scan_and_maybe_truncate(path, /*perform_truncate=*/true);
+
+            KvStateMachine serial(1);
+            ReplayStats rs;
+            auto t0 = chrono::steady_clock::now();
+            bool ok = replay_log(path, 0, [&](uint64_t lsn, const uint8_t* p, uint32_t n) {
+                return serial.apply(0, lsn, p, n);
+            }, rs);
+            double serial_ms = ms_since(t0);
+            if (!ok) { cerr << "[kv-bench] serial replay failed\n"; return 1; }
+
+            KvStateMachine par(threads);
+            ParallelReplayStats ps;
+            t0 = chrono::steady_clock::now();
+            ok = parallel_replay(path, 0, threads, KvStateMachine::key_of,
+                                 [&](unsigned shard, uint64_t lsn, const uint8_t* p, uint32_t n) {
+                                     return par.apply(shard, lsn, p, n);
+                                 }, ps);
+            double par_ms = ms_since(t0);
+            if (!ok) { cerr << "[kv-bench] parallel replay failed\n"; return 1; }
+
+            uint64_t recs = rs.replayed;
+            cout << "[kv-bench] serial:   " << recs << " records in " << serial_ms << " ms ("
+                 << (serial_ms > 0 ? recs * 1000.0 / serial_ms : 0) << " rec/s)\n";
+            cout << "[kv-bench] parallel: " << ps.replay.replayed << " records on " << threads << " threads in " << par_ms
+                 << " ms (" << (par_ms > 0 ? ps.replay.replayed * 1000.0 / par_ms : 0) << " rec/s), batches="
+                 << ps.batches << " barriers=" << ps.barriers << "\n";
+            cout << "[kv-bench] keys=" << par.size() << " digest=" << hex << par.digest() << dec
+                 << (par.digest() == serial.digest() && par.size() == serial.size() ? " (matches serial)" : " (MISMATCH)")
+                 << "\n";
+            return par.digest() == serial.digest() ? 0 : 1;
+        }
+        else if (mode.compare(0, 7, "stripe-") == 0) {
+            vector<string> paths;
+            for (size_t a = 0, b; a <= path.size(); a = b + 1) {
+                b = path.find(',', a);
+                if (b == string::npos) b = path.size();
+                if (b > a) paths.push_back(path.substr(a, b - a));
+            }
+            if (mode == "stripe-write") {
+                if (argc < 5) { cerr << "need N and payload_bytes\n"; return 2; }
+                uint64_t N = stoull(argv[3]);
+                size_t payload = stoul(argv[4]), per_batch = 64;
+                if (argc > 6 && string(argv[5]) == "--batch") per_batch = max<size_t>(1, stoul(argv[6]));
+                StripedWal sw;
+                if (!sw.open(paths)) return 1;
+                vector<vector<uint8_t>> batch(per_batch, vector<uint8_t>(payload));
+                auto t0 = chrono::steady_clock::now();
+                for (uint64_t i = 0; i < N;) {
+                    size_t n = (size_t)min<uint64_t>(per_batch, N - i);
+                    for (size_t k = 0; k < n; ++k) {
+                        for (size_t j = 0; j < payload; ++j) batch[k][j] = uint8_t((i + k + j) & 0xFF);
+                    }
+                    if (!sw.append_batch(batch.data(), n)) { cerr << "[stripe] write failed\n"; return 1; }
+                    i += n;
+                }
+                if (!sw.sync()) { cerr << "[stripe] sync failed\n"; return 1; }
+                double ms = ms_since(t0);
+                cout << "[stripe] wrote " << N << " entries over " << paths.size() << " stripes in " << ms
+                     << " ms, next seq=" << sw.next_seq << "\n";
+                return 0;
+            }
+            if (mode == "stripe-read") {
+                StripeMerge M;
+                if (!M.open(paths)) return 1;
+                uint64_t first = M.next_seq, n = 0, digest = 0;
+                while (M.next()) {
+                    FrameCursor& c = M.current();
+                    digest = mix64(digest ^ hash64(c.payload(), c.len));
+                    n++;
+                    M.advance();
+                }
+                cout << "[stripe] read " << n << " entries in global order, seq=[" << first << ", " << M.next_seq
+                     << ") digest=" << hex << digest << dec << (M.gap ? " (stopped at gap)" : "") << "\n";
+                return 0;
+            }
+            if (mode == "stripe-recover") {
+                StripeRecovery SR;
+                bool ok = recover_stripes(paths, SR);
+                for (size_t i = 0; i < paths.size() && i < SR.scans.size(); ++i) {
+                    const ScanResult& R = SR.scans[i];
+                    cout << "[stripe] " << paths[i] << ": " << R.good_records << " good entries"
+                         << (R.clean ? "" : " (torn tail truncated)");
+                    if (i < SR.cut_bytes.size() && SR.cut_bytes[i]) cout << ", cut " << SR.cut_bytes[i] << " bytes past the gap";
+                    cout << "\n";
+                }
+                cout << "[stripe] contiguous prefix ends at seq " << SR.next_seq << ", dropped "
+                     << SR.orphan_records << " entries after it\n";
+                return ok ? 0 : 1;
+            }
+            cerr << "unknown mode\n"; return 2;
+        }
+        else if (mode == "lanes-write") {
+            if (argc < 7) { cerr << "need lanes, threads, N_per_thread and payload_bytes\n"; return 2; }
+            unsigned nlanes = (unsigned)stoul(argv[3]), nthreads = max(1u, (unsigned)stoul(argv[4]));
+            uint64_t N = stoull(argv[5]);
+            size_t payload = stoul(argv[6]);
+            bool ordered = argc > 7 && string(argv[7]) == "--ordered";
+            WalLanes wl;
+            if (!wl.open(path, nlanes, ordered)) return 1;
+            atomic<bool> failed{false};
+            auto t0 = chrono::steady_clock::now();
+            vector<thread> threads;
+            for (unsigned t = 0; t < nthreads; ++t) {
+                threads.emplace_back([&, t] {
+                    // thread t writes to lane t % lanes: per-thread lanes even when
+                    // threads outnumber cores
+                    vector<uint8_t> buf(payload, uint8_t(t));
+                    for (uint64_t i = 0; i < N && !failed; ++i) {
+                        if (!wl.append(t, buf.data(), (uint32_t)buf.size())) failed = true;
+                    }
+                });
+            }
+            for (auto& t : threads) t.join();
+            if (failed || !wl.sync()) { cerr << "[lanes] write failed\n"; return 1; }
+            double ms = ms_since(t0);
+            cout << "[lanes] wrote " << N * nthreads << " entries from " << nthreads << " threads over "
+                 << wl.lanes.size() << (ordered ? " ordered" : "") << " lanes in " << ms << " ms ("
+                 << (ms > 0 ? N * nthreads * 1000.0 / ms : 0) << " entries/s)\n";
             return 0;
         }
+        else if (mode == "lanes-recover") {
+            unsigned jobs = max(1u, thread::hardware_concurrency());
+            if (argc > 4 && string(argv[3]) == "--jobs") jobs = (unsigned)stoul(argv[4]);
+            vector<string> paths = WalLanes::existing(path);
+            if (paths.empty()) { cerr << "no lanes for " << path << "\n"; return 2; }
+            vector<ScanResult> results;
+            auto t0 = chrono::steady_clock::now();
+            bool ok = recover_lanes(paths, jobs, results);
+            double ms = ms_since(t0);
+            bool ordered = true;
+            for (size_t i = 0; i < paths.size(); ++i) {
+                const ScanResult& R = results[i];
+                ordered = ordered && (R.format.flags & FMT_SEQ);
+                cout << "[lanes] " << paths[i] << ": " << R.good_records << " good entries"
+                     << (R.clean ? "" : " (torn tail truncated)") << "\n";
+            }
+            cout << "[lanes] recovered " << paths.size() << " lanes on " << jobs << " threads in " << ms << " ms\n";
+            if (ordered) {
+                // merge by hybrid timestamp and check the merged order
+                StripeMerge M;
+                M.contiguous = false;
+                if (!M.open(paths, /*headers_only=*/true)) return 1;
+                uint64_t n = 0, first = 0, last = 0;
+                while (M.next()) {
+                    uint64_t ts = M.current().lsn;
+                    if (n++ == 0) first = ts;
+                    if (ts < last) { cerr << "[lanes] merge out of order\n"; return 1; }
+                    last = ts;
+                    M.advance();
+                }
+                cout << "[lanes] merged " << n << " entries by timestamp, ms=[" << (first >> HLC_LOGICAL_BITS) << ", "
+                     << (last >> HLC_LOGICAL_BITS) << "]\n";
+            }
+            return ok ? 0 : 1;
+        }
+        else if (mode == "numa-commit") {
+            if (argc < 6) { cerr << "need threads, N_per_thread and payload_bytes\n"; return 2; }
+            unsigned nthreads = max(1u, (unsigned)stoul(argv[3]));
+            uint64_t N = stoull(argv[4]);
+            size_t payload = stoul(argv[5]);
+            NumaCommitters nc;
+            if (!nc.open(path)) return 1;
+            cout << "[numa] " << nc.topo.nodes() << " node(s):";
+            for (size_t n = 0; n < nc.topo.nodes(); ++n) cout << " node" << n << "=" << nc.topo.node_cpus[n].size() << " cpus";
+            cout << "\n";
+            atomic<bool> failed{false};
+            vector<uint64_t> per_node(nc.topo.nodes(), 0);
+            mutex per_node_mu;
+            auto t0 = chrono::steady_clock::now();
+            vector<thread> threads;
+            for (unsigned t = 0; t < nthreads; ++t) {
+                threads.emplace_back([&, t] {
+                    // spread producers over all nodes, as a multi-socket service would
+                    nc.topo.pin_current_thread(t % nc.topo.nodes());
+                    unsigned node = nc.topo.current_node();
+                    vector<uint8_t> buf(payload, uint8_t(t));
+                    for (uint64_t i = 0; i < N && !failed; ++i) {
+                        if (!nc.commit(buf.data(), (uint32_t)buf.size())) failed = true;
+                    }
+                    lock_guard<mutex> lk(per_node_mu);
+                    per_node[node] += N;
+                });
+            }
+            for (auto& t : threads) t.join();
+            nc.close();
+            double ms = ms_since(t0);
+            if (failed) { cerr << "[numa] commit failed\n"; return 1; }
+            uint64_t total = 0;
+            for (size_t n = 0; n < nc.committers.size(); ++n) {
+                GroupCommitStats gs = nc.committers[n]->stats();
+                const CommitClassStats& C = gs.cls[0];
+                total += gs.records;
+                cout << "[numa] node" << n << ": flusher " << (nc.pinned[n] ? "pinned" : "unpinned") << ", producers committed "
+                     << per_node[n] << ", records=" << gs.records << " syncs=" << gs.batches << " latency avg="
+                     << (C.records ? C.commit_ms_sum / C.records : 0) << " ms p99<=" << C.percentile_ms(0.99) << " ms\n";
+            }
+            cout << "[numa] " << total << " commits in " << ms << " ms (" << (ms > 0 ? total * 1000.0 / ms : 0)
+                 << " commits/s)\n";
+            return 0;
+        }
+        else if (mode == "group-commit") {
+            if (argc < 6) { cerr << "need threads, N_per_thread and payload_bytes\n"; return 2; }
+            unsigned nthreads = max(1u, (unsigned)stoul(argv[3]));
+            uint64_t N = stoull(argv[4]);
+            size_t payload = stoul(argv[5]), bulk_payload = 256 << 10;
+            GroupCommitOptions o;
+            unsigned think_us = 0, bulk_threads = 0;
+            for (int i = 6; i + 1 < argc; i += 2) {
+                string a = argv[i];
+                if (a == "--target-ms") o.target_latency_ms = stod(argv[i + 1]);
+                else if (a == "--think-us") think_us = (unsigned)stoul(argv[i + 1]);
+                else if (a == "--bulk-threads") bulk_threads = (unsigned)stoul(argv[i + 1]);
+                else if (a == "--bulk-bytes") bulk_payload = stoul(argv[i + 1]);
+                else if (a == "--max-queued-mb") o.max_outstanding_bytes = (uint64_t)(stod(argv[i + 1]) * 1048576.0);
+                else if (a == "--max-queued-records") o.max_outstanding_records = stoull(argv[i + 1]);
+                else if (a == "--overload") {
+                    string v = argv[i + 1];
+                    if (v == "block") o.overload = OverloadPolicy::Block;
+                    else if (v == "fail") o.overload = OverloadPolicy::Fail;
+                    else if (v == "shed") o.overload = OverloadPolicy::Shed;
+                    else { cerr << "overload policy is block, fail or shed\n"; return 2; }
+                }
+                else { cerr << "unknown option " << a << "\n"; return 2; }
+            }
+            WalWriter w(path);
+            if (!w.is_open()) { cerr << "[group-commit] cannot open " << path << "\n"; return 1; }
+            GroupCommitStats gs;
+            double ms = 0;
+            bool ok = true;
+            {
+                GroupCommitter gc(w, o);
+                atomic<bool> failed{false}, urgent_done{false};
+                atomic<uint64_t> urgent_refused{0};
+                auto t0 = chrono::steady_clock::now();
+                vector<thread> threads, bulk;
+                for (unsigned t = 0; t < nthreads; ++t) {
+                    threads.emplace_back([&, t] {
+                        vector<uint8_t> buf(payload, uint8_t(t));
+                        for (uint64_t i = 0; i < N && !failed; ++i) {
+                            if (!gc.commit(buf.data(), (uint32_t)buf.size())) {
+                                if (gc.log_failed()) failed = true;
+                                else urgent_refused++;
+                            }
+                            if (think_us) this_thread::sleep_for(chrono::microseconds(think_us));
+                        }
+                    });
+                }
+                // bulk backfill runs for as long as the urgent producers do; it
+                // submits asynchronously, so only admission control bounds it
+                atomic<uint64_t> bulk_refused{0}, bulk_lost{0};
+                for (unsigned t = 0; t < bulk_threads; ++t) {
+                    bulk.emplace_back([&, t] {
+                        vector<uint8_t> buf(bulk_payload, uint8_t(0x80 + t));
+                        while (!urgent_done && !failed) {
+                            if (!gc.submit(buf.data(), (uint32_t)buf.size(), CommitClass::Bulk,
+                                           [&](bool durable) { if (!durable) bulk_lost++; })) {
+                                bulk_refused++;
+                                this_thread::sleep_for(chrono::milliseconds(1));
+                            }
+                        }
+                    });
+                }
+                for (auto& t : threads) t.join();
+                urgent_done = true;
+                for (auto& t : bulk) t.join();
+                gc.close();
+                ms = ms_since(t0);
+                gs = gc.stats();
+                ok = !failed;
+                if (urgent_refused) cout << "[group-commit] urgent commits refused=" << urgent_refused << "\n";
+                if (bulk_threads) {
+                    cout << "[group-commit] bulk submits refused=" << bulk_refused << " not durable=" << bulk_lost << "\n";
+                }
+            }
+            if (!ok) { cerr << "[group-commit] commit failed\n"; return 1; }
+            cout << "[group-commit] " << gs.records << " commits from " << nthreads + bulk_threads << " threads in " << ms
+                 << " ms (" << (ms > 0 ? gs.records * 1000.0 / ms : 0) << " commits/s), syncs=" << gs.batches
+                 << " bulk preempted=" << gs.bulk_preempted << " peak queued=" << gs.peak_outstanding_bytes
+                 << " bytes/" << gs.peak_outstanding_records << " records\n";
+            const char* names[2] = {"urgent", "bulk"};
+            for (int c = 0; c < 2; ++c) {
+                const CommitClassStats& C = gs.cls[c];
+                if (!C.records) continue;
+                cout << "[group-commit] " << names[c] << ": " << C.records << " commits, " << C.bytes << " bytes in "
+                     << C.batches << " batches, latency avg=" << C.commit_ms_sum / C.records << " ms p50<="
+                     << C.percentile_ms(0.5) << " p99<=" << C.percentile_ms(0.99) << " max=" << C.commit_ms_max << " ms\n";
+                if (C.throttled || C.rejected || C.shed) {
+                    cout << "[group-commit] " << names[c] << ": throttled=" << C.throttled << " (" << C.throttled_ms
+                         << " ms) rejected=" << C.rejected << " shed=" << C.shed << "\n";
+                }
+            }
+            cout << "[group-commit] sync_ms=" << gs.sync_ms_ewma << " urgent arrivals/s=" << gs.arrivals_per_s
+                 << " -> linger_ms=" << gs.linger_ms << " batch_limit=" << gs.batch_limit << " (target "
+                 << o.target_latency_ms << " ms)\n";
+            return 0;
+        }
+        else if (mode == "mem-bench") {
+            // write, crash and recover a log held in a MemEnv: CPU cost only
+            if (argc < 5) { cerr << "need N and payload_bytes\n"; return 2; }
+            uint64_t N = stoull(argv[3]), every = 1000, scans = 10;
+            uint32_t payload = (uint32_t)stoul(argv[4]), flags = 0;
+            for (int i = 5; i < argc; ++i) {
+                string o = argv[i];
+                if (o == "--sync-every" && i + 1 < argc) every = max<uint64_t>(stoull(argv[++i]), 1);
+                else if (o == "--chained") flags |= FMT_CHAINED;
+                else if (o == "--scans" && i + 1 < argc) scans = max<uint64_t>(stoull(argv[++i]), 1);
+                else { cerr << "unknown option " << o << "\n"; return 2; }
+            }
+            MemEnv env;
+            uint64_t synced = 0;
+            auto t0 = chrono::steady_clock::now();
+            {
+                WalWriter w(path, flags, env);
+                vector<uint8_t> rec(payload);
+                for (uint64_t i = 0; i < N; ++i) {
+                    for (uint32_t j = 0; j < payload; ++j) rec[j] = uint8_t(i + j);
+                    if (!w.append_record(rec)) { cerr << "append failed\n"; return 1; }
+                    if ((i + 1) % every == 0) {
+                        if (!w.sync()) { cerr << "sync failed\n"; return 1; }
+                        synced = i + 1;
+                    }
+                }
+            }
+            double write_ms = ms_since(t0);
+            uint64_t before = 0, after = 0;
+            env.file_size(path, before);
+            env.crash();
+            bool exists = env.file_size(path, after); // never synced: the file is gone
+            t0 = chrono::steady_clock::now();
+            ScanResult R;
+            for (uint64_t i = 0; exists && i < scans; ++i) {
+                R = scan_and_maybe_truncate(path, i == 0, nullptr, nullptr, false, env);
+            }
+            double scan_ms = ms_since(t0) / scans;
+            cout << "[mem-bench] wrote " << N << " records (" << before << " bytes) in " << write_ms << " ms, "
+                 << env.syncs << " syncs; crash kept " << after << " bytes\n"
+                 << "[mem-bench] recovered " << R.good_records << " records (synced " << synced << ") in "
+                 << scan_ms << " ms per scan, " << (scan_ms > 0 ? after / 1048.576 / scan_ms : 0) << " MB/s\n";
+            return R.good_records == synced ? 0 : 1;
+        }
+        else if (mode == "crash-test") {
+            // recover every crash state of a generated workload, in memory
+            if (argc < 5) { cerr << "need N and max_payload\n"; return 2; }
+            CrashTestOptions opt;
+            opt.records = stoull(argv[3]);
+            opt.max_payload = max<uint32_t>((uint32_t)stoul(argv[4]), 1);
+            opt.threads = max(1u, thread::hardware_concurrency());
+            for (int i = 5; i < argc; ++i) {
+                string o = argv[i];
+                if (o == "--sync-every" && i + 1 < argc) opt.sync_every = max<uint64_t>(stoull(argv[++i]), 1);
+                else if (o == "--chained") opt.flags |= FMT_CHAINED;
+                else if (o == "--seq") opt.flags |= FMT_SEQ;
+                else if (o == "--timestamps") opt.flags |= FMT_TIME;
+                else if (o == "--checkpoint") opt.checkpoints = true;
+                else if (o == "--seed" && i + 1 < argc) opt.seed = stoull(argv[++i]);
+                else if (o == "--max-states" && i + 1 < argc) opt.max_states = max<uint64_t>(stoull(argv[++i]), 1);
+                else if (o == "--threads" && i + 1 < argc) opt.threads = max(1u, (unsigned)stoul(argv[++i]));
+                else { cerr << "unknown option " << o << "\n"; return 2; }
+            }
+            if (opt.checkpoints && !(opt.flags & FMT_CHAINED)) { cerr << "--checkpoint needs --chained\n"; return 2; }
+            CrashTestResult T;
+            if (!crash_test(path, opt, T)) { cerr << "[crash-test] workload failed\n"; return 1; }
+            uint64_t states = T.cut_states + T.reorder_states;
+            cout << "[crash-test] " << opt.records << " records, " << T.log_bytes << " bytes in " << T.writes
+                 << " writes, " << T.boundaries << " sync boundaries\n"
+                 << "[crash-test] " << T.cut_states << " byte cuts + " << T.reorder_states << " reorderings ("
+                 << T.sampled_boundaries << " boundaries sampled) in " << T.ms << " ms on " << opt.threads
+                 << " threads, " << (T.ms > 0 ? states * 1000.0 / T.ms : 0) << " states/s\n";
+            for (const auto& f : T.first_failures) cout << "[crash-test] FAIL " << f << "\n";
+            cout << "[crash-test] " << (T.failures ? "FAILED: " : "OK: ") << T.failures << " of " << states
+                 << " states recovered wrongly\n";
+            return T.failures ? 1 : 0;
+        }
         else if (mode == "corrupt") {
-            if (argc < 4) { cerr << "need bytes_to_cut\n"; return 2; }
-            uint64_t cut = stoull(argv[3]);
+            if (argc < 4) { cerr << "need bytes_to_cut or a mode\n"; return 2; }
             if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
-            return corrupt_tail(path, cut) ? 0 : 1;
+            string m = argv[3];
+            if (m.find_first_not_of("0123456789") == string::npos) return corrupt_tail(path, stoull(m)) ? 0 : 1;
+            CorruptOptions opt;
+            if (!parse_corrupt_mode(m, opt.mode)) { cerr << "unknown corrupt mode " << m << "\n"; return 2; }
+            if (argc < 5) { cerr << "need a byte (or bit) count\n"; return 2; }
+            opt.bytes = stoull(argv[4]);
+            uint64_t clones = 0;
+            string out_dir;
+            for (int i = 5; i < argc; ++i) {
+                string o = argv[i];
+                if (o == "--sector" && i + 1 < argc) opt.sector = max(1u, (uint32_t)stoul(argv[++i]));
+                else if (o == "--extend") opt.extend = true;
+                else if (o == "--seed" && i + 1 < argc) opt.seed = stoull(argv[++i]);
+                else if (o == "--clones" && i + 1 < argc) clones = stoull(argv[++i]);
+                else if (o == "--out" && i + 1 < argc) out_dir = argv[++i];
+                else { cerr << "unknown option " << o << "\n"; return 2; }
+            }
+            string what;
+            if (clones == 0) {
+                if (!corrupt_log(path, opt, what)) { cerr << "[corrupt] failed\n"; return 1; }
+                cout << "[corrupt] " << what << "\n";
+                return 0;
+            }
+            // many variants of one base log: clone it (with its sidecars),
+            // then damage each clone with its own seed
+            if (out_dir.empty()) { cerr << "--clones needs --out <dir>\n"; return 2; }
+            fs::create_directories(out_dir);
+            vector<uint64_t> starts;
+            if (opt.mode == CorruptMode::Stale) {
+                starts = frame_starts(path);
+                opt.frame_starts = &starts;
+            }
+            string base = (fs::path(out_dir) / fs::path(path).filename()).string();
+            map<string, uint64_t> kinds;
+            double clone_ms = 0, damage_ms = 0;
+            uint64_t seed = opt.seed;
+            for (uint64_t i = 0; i < clones; ++i) {
+                string dst = base + "." + to_string(i);
+                auto t0 = chrono::steady_clock::now();
+                const char* how = clone_log(path, dst);
+                if (!how) { cerr << "[corrupt] cannot clone to " << dst << "\n"; return 1; }
+                kinds[how]++;
+                clone_ms += ms_since(t0);
+                t0 = chrono::steady_clock::now();
+                opt.seed = seed + i;
+                if (!corrupt_log(dst, opt, what)) { cerr << "[corrupt] failed on " << dst << "\n"; return 1; }
+                damage_ms += ms_since(t0);
+                cout << "[corrupt] " << dst << ": " << what << "\n";
+            }
+            cout << "[corrupt] " << clones << " variants in " << out_dir << ":";
+            for (const auto& k : kinds) cout << " " << k.second << " by " << k.first;
+            cout << "; cloning " << clone_ms << " ms, damage " << damage_ms << " ms\n";
+            return 0;
         }
         else if (mode == "recover") {
+            // all files are scanned and truncated first, then synced as one batch
+            vector<string> files;
+            unsigned jobs = 1;
+            bool drop_cache = false, verify_padding = false;
+            for (int i = 2; i < argc; ++i) {
+                string a = argv[i];
+                if (a == "--drop-cache") { drop_cache = true; continue; }
+                if (a == "--verify-padding") { verify_padding = true; continue; }
+                if (a == "--io-rate" && i + 1 < argc) recovery_io_limiter().set_rate(stod(argv[++i]) * 1048576.0);
+                else if (a == "--jobs" && i + 1 < argc) jobs = max(1, stoi(argv[++i]));
+                else files.push_back(a);
+            }
+            int rc = 0;
+            vector<size_t> order;
+            for (size_t i = 0; i < files.size(); ++i) {
+                if (!fs::exists(files[i])) { cerr << "file not found: " << files[i] << "\n"; rc = 2; continue; }
+                order.push_back(i);
+            }
+            // logs with a checkpoint only need their tail verified: bring them up first
+            stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return fs::exists(checkpoint_path(files[a])) && !fs::exists(checkpoint_path(files[b]));
+            });
+            SyncBatch batch;
+            vector<ScanResult> results(files.size());
+            vector<char> done(files.size(), 0);
+            atomic<size_t> next{0};
+            auto t0 = chrono::steady_clock::now();
+            vector<thread> workers;
+            for (unsigned t = 0; t < min<size_t>(jobs, order.size()); ++t) {
+                workers.emplace_back([&] {
+                    for (size_t k; (k = next.fetch_add(1)) < order.size();) {
+                        size_t i = order[k];
+                        results[i] = scan_and_maybe_truncate(files[i], /*perform_truncate=*/true, &batch,
+                                                             &recovery_io_limiter(), drop_cache, posix_env(),
+                                                             verify_padding);
+                        done[i] = 1;
+                    }
+                });
+            }
+            for (auto& w : workers) w.join();
+            double scan_ms = ms_since(t0);
+            for (size_t i = 0; i < files.size(); ++i) {
+                if (!done[i]) continue;
+                const ScanResult& R = results[i];
+                if (files.size() > 1) cout << "[recover] " << files[i] << ":\n";
+                if (R.used_checkpoint) {
+                    cout << "[recover] checkpoint certified prefix up to offset=" << R.verified_from
+                         << "; verified tail only\n";
+                }
+                if (R.format.flags & FMT_CIRCULAR) {
+                    cout << "[recover] circular: head=" << R.head_offset << " tail=" << R.last_good_offset
+                         << " seq=[" << R.first_seq << ", " << R.next_seq << ")"
+                         << (R.clean ? "" : " (torn frame at tail will be overwritten)") << "\n";
+                }
+                cout << "[recover] scanned " << R.good_records << " good entries\n";
+                if (drop_cache) cout << "[recover] dropped " << R.dropped_bytes << " verified bytes from page cache\n";
+                if (R.clean) {
+                    cout << "[recover] CLEAN (no action needed)\n";
+                } else {
+                    cout << "[recover] OK: Recovered " << R.good_records << " entries, no parse error.\n";
+                }
+            }
+            if (!batch.flush()) { cerr << "[recover] sync failed; truncation may not be durable\n"; rc = 1; }
+            if (batch.synced_files > 0) {
+                cout << "[recover] synced files=" << batch.synced_files << " dirs=" << batch.synced_dirs
+                     << " sync_ms=" << batch.sync_ms << " scan_ms=" << scan_ms << "\n";
+            }
+            IoLimiter& L = recovery_io_limiter();
+            if (L.bucket.rate > 0) {
+                cout << "[recover] io-limit waited_ms tail=" << L.waited_ms[0] << " full=" << L.waited_ms[1]
+                     << " (bytes tail=" << L.granted[0] << " full=" << L.granted[1] << ")\n";
+            }
+            return rc;
+        }
+        else if (mode == "salvage") {
+            if (argc < 4) { cerr << "need out_file\n"; return 2; }
             if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
-            auto R = scan_and_maybe_truncate(path, /*perform_truncate=*/true);
-            cout << "[recover] scanned " << R.good_records << " good entries\n";
-            if (R.clean) {
-                cout << "[recover] CLEAN (no action needed)\n";
-            } else {
-                cout << "[recover] OK: Recovered " << R.good_records << " entries, no parse error.\n";
+            SalvageResult S;
+            auto t0 = chrono::steady_clock::now();
+            if (!salvage_log(path, argv[3], S)) return 1;
+            double ms = ms_since(t0);
+            for (const auto& r : S.skipped) {
+                cout << "[salvage] skipped [" << r.first << ", " << r.second << ") "
+                     << (r.second - r.first) << " bytes\n";
+            }
+            cout << "[salvage] kept " << S.good_records << " entries (" << S.good_bytes << " bytes), skipped "
+                 << S.skipped.size() << " ranges, crc_attempts=" << S.crc_attempts << ", ms=" << ms << "\n";
+            return 0;
+        }
+        else if (mode == "scrub") {
+            if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
+            ScrubOptions opt;
+            unsigned passes = 1;
+            long interval_s = 0;
+            for (int i = 3; i < argc; ++i) {
+                string o = argv[i];
+                if (o == "--keep-cache") opt.drop_cache = false;
+                else if (o == "--rate" && i + 1 < argc) opt.rate_bytes = stod(argv[++i]) * 1048576.0;
+                else if (o == "--loop" && i + 1 < argc) { passes = 0; interval_s = stol(argv[++i]); }
+                else { cerr << "unknown option " << o << "\n"; return 2; }
             }
+            opt.on_bad = [](uint64_t b, uint64_t e) {
+                cout << "[scrub] BAD range [" << b << ", " << e << ") " << (e - b) << " bytes\n";
+            };
+            bool any_bad = false;
+            auto t0 = chrono::steady_clock::now();
+            BackgroundScrubber bg;
+            bg.start(path, opt, chrono::seconds(interval_s), passes, [&](const ScrubResult& R) {
+                double ms = ms_since(t0);
+                any_bad = any_bad || !R.bad.empty();
+                cout << "[scrub] pass " << (R.completed ? "complete" : "paused") << ": from=" << R.resumed_from
+                     << " sealed_end=" << R.sealed_end << " frames=" << R.frames << " bytes=" << R.bytes
+                     << " bad_ranges=" << R.bad.size() << " MB/s=" << (ms > 0 ? R.bytes / 1048.576 / ms : 0)
+                     << " dropped=" << R.dropped_bytes << "\n";
+                t0 = chrono::steady_clock::now();
+            });
+            bg.join();
+            return any_bad ? 1 : 0;
+        }
+        else if (mode == "lookup-bench") {
+            if (argc < 4) { cerr << "need lookups\n"; return 2; }
+            if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
+            uint64_t lookups = stoull(argv[3]), cache_mb = 64, block_kb = 64, lookback = 100000;
+            unsigned threads = 4;
+            for (int i = 4; i < argc; ++i) {
+                string o = argv[i];
+                if (o == "--cache-mb" && i + 1 < argc) cache_mb = stoull(argv[++i]);
+                else if (o == "--block-kb" && i + 1 < argc) block_kb = max<uint64_t>(stoull(argv[++i]), 1);
+                else if (o == "--lookback" && i + 1 < argc) lookback = stoull(argv[++i]);
+                else if (o == "--threads" && i + 1 < argc) threads = max(stoi(argv[++i]), 1);
+                else { cerr << "unknown option " << o << "\n"; return 2; }
+            }
+            RecordReader plain;
+            if (!plain.open(path)) { cerr << "cannot open " << path << "\n"; return 1; }
+            double base = lookup_bench(plain, lookups, lookback, threads);
+            cout << "[lookup] no cache: " << base << " lookups/s, preads=" << plain.preads.load() << "\n";
+            BlockCache cache(cache_mb << 20, (uint32_t)(block_kb << 10));
+            RecordReader cached;
+            if (!cached.open(path, &cache)) { cerr << "cannot open " << path << "\n"; return 1; }
+            double fast = lookup_bench(cached, lookups, lookback, threads);
+            BlockCacheStats st = cache.stats();
+            cout << "[lookup] cache " << cache_mb << "MB/" << block_kb << "KB blocks: " << fast << " lookups/s, hits="
+                 << st.hits << " misses=" << st.misses << " hit_ratio=" << st.hit_ratio()
+                 << " evictions=" << st.evictions << " cached=" << st.bytes << " pinned=" << st.pinned_bytes << "\n";
             return 0;
         }
+        else if (mode == "open-append") {
+            if (argc < 5) { cerr << "need N and payload_bytes\n"; return 2; }
+            if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
+            int N = stoi(argv[3]);
+            int payload = stoi(argv[4]);
+            uint64_t window = 4ull << 20;
+            for (int i = 5; i < argc; ++i) {
+                string o = argv[i];
+                if (o == "--window" && i + 1 < argc) window = (uint64_t)(stod(argv[++i]) * 1048576.0);
+                else { cerr << "unknown option " << o << "\n"; return 2; }
+            }
+            auto t0 = chrono::steady_clock::now();
+            bool done = false;
+            ScrubResult V;
+            FastOpen fo;
+            bool ok = open_for_append(path, window, fo,
+                [](uint64_t b, uint64_t e) {
+                    lock_guard<mutex> lk(cout_mu);
+                    cout << "[open-append] BAD range [" << b << ", " << e << ") " << (e - b) << " bytes\n";
+                },
+                [&](const ScrubResult& R) {
+                    V = R; // read after join()
+                    done = true;
+                });
+            if (!ok) return 1;
+            WalWriter& w = *fo.writer;
+            {
+                lock_guard<mutex> lk(cout_mu);
+                cout << "[open-append] open took " << ms_since(t0) << " ms: ";
+                if (fo.verify_end > fo.verify_begin) {
+                    cout << "tail verified from offset " << fo.verify_end << ", background verifies ["
+                         << fo.verify_begin << ", " << fo.verify_end << ")\n";
+                } else {
+                    cout << "full scan, " << fo.scan.good_records << " records\n";
+                }
+            }
+            auto t1 = chrono::steady_clock::now();
+            vector<uint8_t> rec((size_t)payload, 'a');
+            for (int i = 0; i < N; ++i) {
+                if (!w.append_record(rec)) { cerr << "append failed\n"; return 1; }
+            }
+            if (!w.sync()) { cerr << "sync failed\n"; return 1; }
+            {
+                lock_guard<mutex> lk(cout_mu);
+                cout << "[open-append] appended " << N << " records in " << ms_since(t1) << " ms\n";
+            }
+            fo.verifier.join();
+            if (!done) { cerr << "background verification failed\n"; return 1; }
+            w.prefix_verified(V.frames);
+            cout << "[open-append] background verification done after " << ms_since(t0) << " ms: frames="
+                 << V.frames << " bytes=" << V.bytes << " bad_ranges=" << V.bad.size() << "\n"
+                 << "[open-append] records=" << w.records << " next_lsn=" << w.next_seq << "\n";
+            return V.bad.empty() ? 0 : 1;
+        }
+        else if (mode == "ship") {
+            if (argc < 4) { cerr << "need addr\n"; return 2; }
+            if (!fs::exists(path)) { cerr << "file not found\n"; return 2; }
+            bool follow = argc > 4 && string(argv[4]) == "--follow";
+            ShipStats st;
+            bool ok = ship_log(path, argv[3], follow, st);
+            double mb = st.shipped_bytes / 1048576.0;
+            cout << "[ship] shipped " << st.shipped_bytes << " bytes, acked offset=" << st.acked
+                 << ", wall_ms=" << st.wall_ms << ", cpu_ms_per_MB=" << (mb > 0 ? st.cpu_ms / mb : 0)
+                 << ", lag_ms avg=" << (st.lag_samples ? st.sum_lag_ms / st.lag_samples : 0)
+                 << " max=" << st.max_lag_ms << "\n";
+            return ok ? 0 : 1;
+        }
+        else if (mode == "receive") {
+            if (argc < 4) { cerr << "need addr\n"; return 2; }
+            ReceiveStats st;
+            bool ok = receive_log(path, argv[3], st);
+            double mb = st.bytes / 1048576.0;
+            cout << "[receive] applied " << st.records << " entries from offset=" << st.start_offset
+                 << ", durable=" << st.durable << ", cpu_ms_per_MB=" << (mb > 0 ? st.cpu_ms / mb : 0) << "\n";
+            return ok ? 0 : 1;
+        }
         else if (mode == "demo") {
             if (argc < 5) { cerr << "need N and payload_bytes\n"; return 2; }
             int N = stoi(argv[3]);